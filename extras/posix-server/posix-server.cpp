@@ -0,0 +1,43 @@
+// WebSocketServer running on Linux (NETWORK_CONTROLLER_POSIX), build with:
+//
+//   g++ -std=c++11 -O2 -DHOST_BUILD -I../../src -o posix-server
+//     posix-server.cpp $(find ../../src -name '*.cpp')
+//
+// Increase file descriptor limit (ulimit -n) for thousands of clients.
+
+#include <WebSocketServer.h>
+using namespace net;
+
+constexpr uint16_t port = 3000;
+WebSocketServer wss{port};
+
+void setup() {
+  wss.onConnection([](WebSocket &ws) {
+    ws.onMessage([](WebSocket &ws, const WebSocket::DataType dataType,
+                   const char *message, uint16_t length) {
+      ws.send(dataType, message, length);
+    });
+    ws.onClose([](WebSocket &, const WebSocket::CloseCode, const char *,
+                 uint16_t) { Serial.println(F("Disconnected")); });
+
+    Serial.print(F("New client: "));
+    Serial.println(ws.getRemoteIP());
+  });
+
+  wss.begin();
+
+  Serial.print(F("Server running at port "));
+  Serial.println(port);
+}
+
+void loop() {
+  wss.listen();
+  // Don't burn CPU when idle
+  if (wss.countClients() == 0) delay(1);
+}
+
+int main() {
+  setup();
+  while (true)
+    loop();
+}
@@ -0,0 +1,216 @@
+// Checks that messages posted from other threads arrive exactly once and in
+// the order of each producer. Linux, build with:
+//
+//   g++ -std=c++11 -O2 -DHOST_BUILD -D_THREAD_SAFE_SEND -I../../src
+//     -o post-stress post-stress.cpp $(find ../../src -name '*.cpp')
+//     -lpthread
+//
+// Usage: post-stress [producers] [messages per producer and target]
+//
+// kClients clients stay connected, one more connects and disconnects all the
+// time. Every producer thread posts numbered messages to each client with
+// WebSocketServer::postTo(), to all of them with WebSocketServer::post(), and
+// to the server through WebSocketClient::post(). Messages to the reconnecting
+// client mostly carry stale ids, they must be dropped, never delivered to
+// another connection. Build with -fsanitize=thread (or address) as well.
+//
+// Each client runs on its own thread: listen() waits for the rest of a frame,
+// so a thread with all of them could wait on the server while the server
+// waits on another one.
+
+#include <WebSocketClient.h>
+#include <WebSocketServer.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+using namespace net;
+
+#ifdef _SHARDING
+#  error "Clients moved between shards may miss posted messages"
+#endif
+
+namespace {
+
+constexpr uint16_t kPort{3200};
+constexpr uint8_t kClients{4};
+/// Index of the client that keeps reconnecting.
+constexpr uint8_t kChurn{kClients};
+constexpr uint32_t kTimeout{10000};
+
+enum Kind : uint8_t { kDirect, kBroadcast, kUpstream, kKinds };
+struct message_t {
+  /// Id of server endpoint (kDirect) or index of client (kUpstream).
+  uint32_t target;
+  uint32_t sequence;
+  uint16_t producer;
+  Kind kind;
+};
+
+uint16_t producers{4};
+uint32_t messages{2000};
+
+WebSocketServer server{kPort};
+WebSocketClient clients[kClients + 1];
+/// Server side id of each client, announced on connection.
+std::atomic<uint32_t> ids[kClients + 1];
+std::atomic<bool> running{true};
+
+/// Next sequence expected from each producer, indexed by [target][producer].
+std::vector<std::vector<uint32_t>> expected[kKinds];
+std::atomic<uint64_t> received{0};
+std::atomic<uint32_t> errors{0};
+/// Current connection of the reconnecting client got its id.
+bool announced{false};
+uint32_t reconnects{0};
+
+void fail(const char *what, const message_t &message) {
+  if (errors++ < 10)
+    fprintf(stderr, "%s: kind %u, target %u, producer %u, sequence %u\n", what,
+      message.kind, message.target, message.producer, message.sequence);
+}
+/// Checks that message is the next one of its producer.
+void check(uint8_t target, const message_t &message) {
+  auto &next = expected[message.kind][target][message.producer];
+  if (message.sequence != next) fail("Out of order", message);
+  next = message.sequence + 1;
+  ++received;
+}
+
+/// Posts until there is room in the queue (or the test is over).
+template <typename Post> void retry(Post post) {
+  while (!post() && running)
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+}
+void produce(uint16_t producer) {
+  for (uint32_t sequence = 0; sequence < messages; ++sequence) {
+    for (uint8_t i = 0; i <= kClients; ++i) {
+      const message_t message{ids[i], sequence, producer, kDirect};
+      retry([&] {
+        return server.postTo(message.target, WebSocket::DataType::BINARY,
+          reinterpret_cast<const char *>(&message), sizeof(message));
+      });
+    }
+    const message_t broadcast{0, sequence, producer, kBroadcast};
+    retry([&] {
+      return server.post(WebSocket::DataType::BINARY,
+        reinterpret_cast<const char *>(&broadcast), sizeof(broadcast));
+    });
+    for (uint8_t i = 0; i < kClients; ++i) {
+      const message_t message{i, sequence, producer, kUpstream};
+      retry([&] {
+        return clients[i].post(WebSocket::DataType::BINARY,
+          reinterpret_cast<const char *>(&message), sizeof(message));
+      });
+    }
+  }
+}
+
+void setupServer() {
+  server.onConnection([](WebSocket &ws) {
+    const auto id = ws.getId();
+    ws.send(WebSocket::DataType::BINARY, reinterpret_cast<const char *>(&id),
+      sizeof(id));
+    ws.onMessage([](WebSocket &, const WebSocket::DataType, const char *data,
+                   uint16_t length) {
+      message_t message;
+      if (length != sizeof(message)) return fail("Bad size", message_t{});
+      memcpy(&message, data, length);
+      if (message.kind != kUpstream || message.target >= kClients)
+        return fail("Unexpected", message);
+      check(message.target, message);
+    });
+  });
+  server.begin();
+}
+void setupClient(uint8_t i) {
+  clients[i].onMessage([i](WebSocket &, const WebSocket::DataType,
+                         const char *data, uint16_t length) {
+    if (length == sizeof(uint32_t)) {
+      uint32_t id;
+      memcpy(&id, data, length);
+      ids[i] = id;
+      if (i == kChurn) announced = true;
+      return;
+    }
+    message_t message;
+    if (length != sizeof(message)) return fail("Bad size", message_t{});
+    memcpy(&message, data, length);
+    if (message.kind == kDirect && message.target != ids[i])
+      return fail("Misdirected", message);
+    if (i != kChurn) return check(i, message);
+
+    // Reconnecting client misses messages, but still gets them in order
+    auto &next = expected[message.kind][i][message.producer];
+    if (message.sequence < next) fail("Out of order", message);
+    next = message.sequence + 1;
+  });
+}
+
+void runClient(uint8_t i) {
+  auto &client = clients[i];
+  client.openAsync("127.0.0.1", kPort);
+  while (running) {
+    client.listen();
+    if (i != kChurn) continue;
+
+    if (client.getReadyState() == WebSocket::ReadyState::OPEN && announced) {
+      client.close(WebSocket::NORMAL_CLOSURE, false);
+      announced = false;
+    } else if (client.getReadyState() == WebSocket::ReadyState::CLOSED) {
+      // The old id stays with producers until the new one is announced
+      client.openAsync("127.0.0.1", kPort);
+      ++reconnects;
+    }
+  }
+  client.terminate();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) producers = atoi(argv[1]);
+  if (argc > 2) messages = atoi(argv[2]);
+  for (auto &perKind : expected)
+    perKind.assign(kClients + 1, std::vector<uint32_t>(producers, 0));
+
+  setupServer();
+  for (uint8_t i = 0; i <= kClients; ++i)
+    setupClient(i);
+
+  std::vector<std::thread> threads;
+  threads.emplace_back([] {
+    while (running)
+      server.listen();
+  });
+  for (uint8_t i = 0; i <= kClients; ++i)
+    threads.emplace_back(runClient, i);
+
+  // Producers start once every client knows its id
+  const uint32_t start{millis()};
+  bool ready{false};
+  while (!ready && millis() - start < kTimeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    ready = true;
+    for (auto &id : ids)
+      if (!id) ready = false;
+  }
+  for (uint16_t i = 0; ready && i < producers; ++i)
+    threads.emplace_back(produce, i);
+
+  const uint64_t total{
+    static_cast<uint64_t>(producers) * messages * kClients * kKinds};
+  while (ready && received < total && millis() - start < kTimeout)
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  running = false;
+  for (auto &thread : threads)
+    thread.join();
+  server.shutdown();
+
+  printf("Producers: %u, received: %llu of %llu, reconnects: %u, errors: %u\n",
+    producers, static_cast<unsigned long long>(received.load()),
+    static_cast<unsigned long long>(total), reconnects, errors.load());
+  const bool passed{ready && received == total && errors == 0};
+  printf(passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
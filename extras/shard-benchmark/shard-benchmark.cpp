@@ -0,0 +1,201 @@
+// Measures how a sharded WebSocketServer scales with the number of shard
+// threads (1, 2, 4, 8). Linux, build with:
+//
+//   g++ -std=c++11 -O2 -DHOST_BUILD -D_SHARDING -I../../src
+//     -o shard-benchmark shard-benchmark.cpp $(find ../../src -name '*.cpp')
+//     -lpthread
+//
+// Usage: shard-benchmark [connections] [seconds] [handler work in us]
+//
+// Each round starts a server with N shards and echoes messages of clients
+// run by kClientThreads load generator threads in the same process. Every
+// message handler spins for the given time (default 20 us), which stands in
+// for application work. Run it on a host with at least 8 + kClientThreads
+// cores, otherwise shards compete with each other (and the load generator)
+// for CPU and the numbers show no scaling.
+
+#include <WebSocketServer.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace net;
+
+#ifndef _SHARDING
+#  error "Build with -D_SHARDING"
+#endif
+
+namespace {
+
+constexpr uint16_t kBasePort{3100};
+constexpr uint8_t kShardCounts[]{1, 2, 4, 8};
+constexpr uint8_t kClientThreads{4};
+/// Messages each connection keeps in flight.
+constexpr uint8_t kPipeline{4};
+constexpr uint8_t kPayloadSize{32};
+/// Echo frame sent by server (unmasked, 2 byte header).
+constexpr uint8_t kEchoSize{2 + kPayloadSize};
+
+std::atomic<bool> running{false};
+std::atomic<uint64_t> echoes{0};
+/// Server of the current round (over-aligned, hence not on heap).
+alignas(WebSocketServer) uint8_t storage[sizeof(WebSocketServer)];
+
+/// @return Socket with finished handshake, -1 on failure.
+int openConnection(uint16_t port) {
+  const int fd{socket(AF_INET, SOCK_STREAM, 0)};
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address))) {
+    close(fd);
+    return -1;
+  }
+  const int enable{1};
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+  char request[160];
+  const int length{snprintf(request, sizeof(request),
+    "GET / HTTP/1.1\r\nHost: 127.0.0.1:%u\r\nUpgrade: websocket\r\n"
+    "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n",
+    port)};
+  send(fd, request, length, 0);
+
+  // Response ends with an empty line, no frames arrive before a request
+  char response[256]{};
+  size_t size{0};
+  while (size < sizeof(response) - 1 && !strstr(response, "\r\n\r\n")) {
+    const auto n = recv(fd, response + size, sizeof(response) - 1 - size, 0);
+    if (n <= 0) break;
+    size += n;
+  }
+  if (!strstr(response, " 101 ")) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void sendMessages(int fd, uint8_t count) {
+  // Zero masking key leaves payload as is
+  uint8_t frames[kPipeline * (2 + 4 + kPayloadSize)]{};
+  for (uint8_t i = 0; i < count; ++i) {
+    auto frame = frames + i * (2 + 4 + kPayloadSize);
+    frame[0] = 0x81;
+    frame[1] = 0x80 | kPayloadSize;
+    memset(frame + 2 + 4, 'x', kPayloadSize);
+  }
+  send(fd, frames, count * (2 + 4 + kPayloadSize), MSG_NOSIGNAL);
+}
+
+/// Keeps kPipeline messages in flight on each of its connections.
+void generateLoad(const std::vector<int> &fds) {
+  std::vector<pollfd> polled;
+  std::vector<size_t> pending(fds.size(), 0);
+  for (auto fd : fds) {
+    polled.push_back({fd, POLLIN, 0});
+    sendMessages(fd, kPipeline);
+  }
+
+  uint8_t buffer[4096];
+  while (running) {
+    if (poll(polled.data(), polled.size(), 10) <= 0) continue;
+
+    for (size_t i = 0; i < polled.size(); ++i) {
+      if (!(polled[i].revents & POLLIN)) continue;
+      const auto n = recv(polled[i].fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        polled[i].events = 0;
+        continue;
+      }
+      pending[i] += n;
+      const auto count = static_cast<uint8_t>(pending[i] / kEchoSize);
+      pending[i] %= kEchoSize;
+      echoes += count;
+      if (count) sendMessages(polled[i].fd, count);
+    }
+  }
+}
+
+/// @return Echoed messages per second.
+uint64_t runRound(uint8_t shards, uint16_t port, uint16_t connections,
+  uint32_t seconds, uint32_t work) {
+  auto server = new (storage) WebSocketServer{port};
+  server->setShards(shards);
+  server->onConnection([work](WebSocket &ws) {
+    ws.onMessage([work](WebSocket &ws, const WebSocket::DataType dataType,
+                   const char *message, uint16_t length) {
+      const auto end = std::chrono::steady_clock::now() +
+                       std::chrono::microseconds{work};
+      while (std::chrono::steady_clock::now() < end) {}
+      ws.send(dataType, message, length);
+    });
+  });
+  server->begin();
+
+  running = true;
+  std::vector<std::thread> threads;
+  for (uint8_t i = 0; i < shards; ++i)
+    threads.emplace_back([server, i] {
+      while (running)
+        server->listen(i);
+    });
+
+  std::vector<std::vector<int>> clients(kClientThreads);
+  for (uint16_t i = 0; i < connections; ++i) {
+    const int fd{openConnection(port)};
+    if (fd != -1) clients[i % kClientThreads].push_back(fd);
+  }
+  std::vector<std::thread> generators;
+  for (const auto &fds : clients)
+    generators.emplace_back(generateLoad, std::cref(fds));
+
+  // Warm up (connections spread across shards meanwhile)
+  std::this_thread::sleep_for(std::chrono::seconds{1});
+  const auto start = echoes.load();
+  std::this_thread::sleep_for(std::chrono::seconds{seconds});
+  const auto count = echoes.load() - start;
+
+  running = false;
+  for (auto &thread : generators)
+    thread.join();
+  for (auto &thread : threads)
+    thread.join();
+  for (const auto &fds : clients)
+    for (auto fd : fds)
+      close(fd);
+  server->shutdown();
+  server->~WebSocketServer();
+
+  return count / seconds;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const uint16_t connections = argc > 1 ? atoi(argv[1]) : 64;
+  const uint32_t seconds = argc > 2 ? atoi(argv[2]) : 5;
+  const uint32_t work = argc > 3 ? atoi(argv[3]) : 20;
+
+  printf("%u connections, %u s per round, %u us per message, %u cores\n",
+    connections, seconds, work, std::thread::hardware_concurrency());
+  printf("shards  messages/s  speedup\n");
+  uint64_t baseline{0};
+  uint16_t port{kBasePort};
+  for (auto shards : kShardCounts) {
+    const auto rate = runRound(shards, port++, connections, seconds, work);
+    if (!baseline) baseline = rate ? rate : 1;
+    printf("%6u  %10llu  %7.2f\n", shards,
+      static_cast<unsigned long long>(rate),
+      static_cast<double>(rate) / baseline);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+// Checks that with _STATIC_MEMORY neither WebSocketServer nor WebSocketClient
+// allocates from heap once begin() returns. Linux (glibc), build with:
+//
+//   g++ -std=c++11 -O2 -DHOST_BUILD -D_STATIC_MEMORY -rdynamic -I../../src
+//     -o static-memory static-memory.cpp $(find ../../src -name '*.cpp')
+//
+// Allocations made by PosixClient/PosixServer are not counted, they stand in
+// for buffers of a network controller (or its driver) on a board.
+
+#include <WebSocketClient.h>
+#include <WebSocketServer.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+using namespace net;
+
+#ifndef _STATIC_MEMORY
+#  error "Build with -D_STATIC_MEMORY"
+#endif
+
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+}
+
+namespace {
+
+bool counting{false};
+thread_local bool inHook{false};
+size_t allocations{0};
+
+/// @return true if address belongs to a member function of the transport.
+bool isTransport(void *address) {
+  Dl_info info{};
+  // Mangled names, parameter types don't count
+  return dladdr(address, &info) && info.dli_sname &&
+         (strncmp(info.dli_sname, "_ZN3net11PosixClient", 20) == 0 ||
+           strncmp(info.dli_sname, "_ZN3net11PosixServer", 20) == 0);
+}
+void onAllocation() {
+  if (!counting || inHook) return;
+
+  inHook = true;
+  void *frames[16];
+  const auto depth = backtrace(frames, 16);
+  bool transport{false};
+  for (int i = 0; i < depth && !transport; ++i)
+    transport = isTransport(frames[i]);
+  if (!transport) {
+    ++allocations;
+    fprintf(stderr, "Heap allocation:\n");
+    backtrace_symbols_fd(frames, depth, 2);
+  }
+  inHook = false;
+}
+
+} // namespace
+
+extern "C" {
+void *malloc(size_t size) {
+  onAllocation();
+  return __libc_malloc(size);
+}
+void *calloc(size_t count, size_t size) {
+  onAllocation();
+  return __libc_calloc(count, size);
+}
+void *realloc(void *p, size_t size) {
+  onAllocation();
+  return __libc_realloc(p, size);
+}
+}
+
+constexpr uint16_t port = 3001;
+constexpr uint16_t kCycles = 50;
+
+WebSocketServer server{port};
+WebSocketClient client;
+uint16_t echoes{0};
+uint16_t protocols{0};
+
+int main() {
+  // Warm up, the first call of backtrace() and stdout buffer allocate
+  void *frames[1];
+  backtrace(frames, 1);
+  printf("Checking heap allocations after begin()\n");
+  fflush(stdout);
+
+  server.onConnection([](WebSocket &ws) {
+    ws.onMessage([](WebSocket &ws, const WebSocket::DataType dataType,
+                   const char *message, uint16_t length) {
+      ws.send(dataType, message, length);
+    });
+    ws.setOverflowPolicy(WebSocket::OverflowPolicy::CONFLATE);
+    server.subscribe(ws, 0);
+  });
+  client.onOpen([](WebSocket &ws) {
+    if (ws.getProtocol() && strcmp(ws.getProtocol(), "chat") == 0)
+      ++protocols;
+    ws.send(WebSocket::DataType::TEXT, "Hello", 5);
+  });
+  client.onMessage([](WebSocket &ws, const WebSocket::DataType,
+                     const char *message, uint16_t length) {
+    // Published ticks arrive as well
+    if (length != 5 || strncmp(message, "Hello", 5) != 0) return;
+    ++echoes;
+    ws.close(WebSocket::NORMAL_CLOSURE, false);
+  });
+
+  server.begin();
+  counting = true;
+
+  for (uint16_t i = 0; i < kCycles; ++i) {
+    // Every other client offers a subprotocol too long to be selected
+    client.openAsync("127.0.0.1", port, "/",
+      i % 2 ? "chat" : "an-unreasonably-long-subprotocol-name");
+    const auto start = millis();
+    while (millis() - start < kTimeoutInterval &&
+           (client.getReadyState() != WebSocket::ReadyState::CLOSED ||
+             server.countClients() > 0)) {
+      client.listen();
+      server.listen();
+      server.publish(0, WebSocket::DataType::TEXT, "tick", 4);
+    }
+  }
+
+  server.shutdown();
+  counting = false;
+
+  printf("Cycles: %u, echoes: %u, negotiated: %u, heap allocations: %zu\n",
+    kCycles, echoes, protocols, allocations);
+  const bool passed{
+    allocations == 0 && echoes == kCycles && protocols == kCycles / 2};
+  printf(passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+// Checks that WebSocketClient resumes the TLS session of its previous
+// connection while verifying the server certificate. Linux, build with:
+//
+//   g++ -std=c++11 -O2 -DHOST_BUILD -D_TLS -I../../src
+//     -o tls-resume tls-resume.cpp $(find ../../src -name '*.cpp')
+//     -lssl -lcrypto -lpthread
+//
+// WebSocketServer doesn't speak TLS, a minimal OpenSSL echo server runs on
+// its own thread instead. Its certificate is self-signed (generated at
+// start, for 127.0.0.1) and given to the client by setSecure(), so the
+// regular verification path is taken. For TLS 1.2 (session id) and TLS 1.3
+// (ticket) the client connects twice, the first handshake must be a full one,
+// the second one resumed (on both ends).
+
+#include <WebSocketClient.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+using namespace net;
+
+#ifndef _TLS
+#  error "Build with -D_TLS"
+#endif
+
+namespace {
+
+constexpr uint16_t kPort{3443};
+constexpr uint8_t kConnections{2};
+constexpr uint32_t kTimeout{5000};
+
+EVP_PKEY *key{nullptr};
+X509 *certificate{nullptr};
+std::string certificatePem;
+
+/// Server side view of each connection of the current round.
+std::atomic<bool> serverResumed[kConnections];
+std::atomic<uint8_t> accepted{0};
+
+/// @brief Creates P-256 key and self-signed certificate for 127.0.0.1.
+bool makeCertificate() {
+  auto context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  if (!context || EVP_PKEY_keygen_init(context) != 1 ||
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(context, NID_X9_62_prime256v1) !=
+        1 ||
+      EVP_PKEY_keygen(context, &key) != 1)
+    return false;
+  EVP_PKEY_CTX_free(context);
+
+  certificate = X509_new();
+  X509_set_version(certificate, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+  X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+  X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+  X509_set_pubkey(certificate, key);
+  auto name = X509_get_subject_name(certificate);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+    reinterpret_cast<const unsigned char *>("tls-resume"), -1, -1, 0);
+  X509_set_issuer_name(certificate, name);
+
+  // Client verifies the address it connects to
+  X509V3_CTX v3{};
+  X509V3_set_ctx_nodb(&v3);
+  X509V3_set_ctx(&v3, certificate, certificate, nullptr, nullptr, 0);
+  auto extension = X509V3_EXT_conf_nid(
+    nullptr, &v3, NID_subject_alt_name, const_cast<char *>("IP:127.0.0.1"));
+  if (!extension) return false;
+  X509_add_ext(certificate, extension, -1);
+  X509_EXTENSION_free(extension);
+  if (!X509_sign(certificate, key, EVP_sha256())) return false;
+
+  auto bio = BIO_new(BIO_s_mem());
+  PEM_write_bio_X509(bio, certificate);
+  char *data{nullptr};
+  const auto size = BIO_get_mem_data(bio, &data);
+  certificatePem.assign(data, size);
+  BIO_free(bio);
+  return true;
+}
+
+bool readExactly(SSL *ssl, uint8_t *buffer, int size) {
+  while (size > 0) {
+    const auto n = SSL_read(ssl, buffer, size);
+    if (n <= 0) return false;
+    buffer += n;
+    size -= n;
+  }
+  return true;
+}
+
+/// @brief Answers the handshake and echoes (short) frames until close.
+void serve(SSL *ssl) {
+  std::string request;
+  char chunk[256];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    const auto n = SSL_read(ssl, chunk, sizeof(chunk));
+    if (n <= 0) return;
+    request.append(chunk, n);
+  }
+  constexpr char kKeyHeader[]{"Sec-WebSocket-Key: "};
+  const auto begin = request.find(kKeyHeader);
+  if (begin == std::string::npos) return;
+  const auto secKey = request.substr(begin + sizeof(kKeyHeader) - 1, 24);
+  char acceptKey[29]{};
+  encodeSecKey(secKey.c_str(), acceptKey);
+
+  const auto response = std::string{"HTTP/1.1 101 Switching Protocols\r\n"
+                                    "Upgrade: websocket\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Sec-WebSocket-Accept: "} +
+                        acceptKey + "\r\n\r\n";
+  SSL_write(ssl, response.data(), static_cast<int>(response.size()));
+
+  uint8_t header[2], mask[4], payload[125];
+  while (readExactly(ssl, header, 2)) {
+    const uint8_t opcode = header[0] & 0x0F;
+    const uint8_t length = header[1] & 0x7F;
+    if (length > sizeof(payload) || !readExactly(ssl, mask, 4) ||
+        !readExactly(ssl, payload, length))
+      return;
+    for (uint8_t i = 0; i < length; ++i)
+      payload[i] ^= mask[i % 4];
+
+    const uint8_t reply[2]{static_cast<uint8_t>(0x80 | opcode), length};
+    SSL_write(ssl, reply, 2);
+    if (length > 0) SSL_write(ssl, payload, length);
+    if (opcode == 0x08) return;
+  }
+}
+
+/// @brief Accepts kConnections connections, one at a time.
+void runServer(int listener, int version) {
+  auto context = SSL_CTX_new(TLS_server_method());
+  SSL_CTX_set_min_proto_version(context, version);
+  SSL_CTX_set_max_proto_version(context, version);
+  SSL_CTX_use_certificate(context, certificate);
+  SSL_CTX_use_PrivateKey(context, key);
+
+  for (uint8_t i = 0; i < kConnections; ++i) {
+    pollfd pfd{listener, POLLIN, 0};
+    if (poll(&pfd, 1, kTimeout) != 1) break;
+    const int fd{accept(listener, nullptr, nullptr)};
+    if (fd == -1) break;
+    // Client that gave up mustn't stall the server
+    timeval timeout{kTimeout / 1000, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    auto ssl = SSL_new(context);
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) == 1) {
+      serverResumed[i] = SSL_session_reused(ssl);
+      ++accepted;
+      serve(ssl);
+      SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    close(fd);
+  }
+  SSL_CTX_free(context);
+}
+
+int openListener(uint16_t port) {
+  const int fd{socket(AF_INET, SOCK_STREAM, 0)};
+  int enable{1};
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(fd, kConnections) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// @return Whether the session has been resumed (-1 if connection failed).
+int8_t connectOnce(WebSocketClient &client, uint16_t port) {
+  bool echoed{false};
+  client.onMessage([&echoed](WebSocket &, const WebSocket::DataType,
+                     const char *message, uint16_t length) {
+    echoed = length == 5 && strncmp(message, "Hello", 5) == 0;
+  });
+
+  // Handshake is driven by listen(), as in an application loop
+  client.openAsync("127.0.0.1", port);
+  const auto start = millis();
+  while (client.getReadyState() == WebSocket::ReadyState::CONNECTING &&
+         millis() - start < kTimeout) {
+    client.listen();
+    delay(1);
+  }
+  if (client.getReadyState() != WebSocket::ReadyState::OPEN) return -1;
+  const int8_t resumed = client.isSessionResumed();
+
+  client.send(WebSocket::DataType::TEXT, "Hello", 5);
+  while (!echoed && client.getReadyState() == WebSocket::ReadyState::OPEN &&
+         millis() - start < kTimeout) {
+    client.listen();
+    delay(1);
+  }
+  // Session (or ticket) is cached once the connection is closed
+  client.close(WebSocket::NORMAL_CLOSURE, false);
+  while (client.getReadyState() != WebSocket::ReadyState::CLOSED &&
+         millis() - start < kTimeout) {
+    client.listen();
+    delay(1);
+  }
+  client.terminate();
+  return echoed ? resumed : -1;
+}
+
+} // namespace
+
+int main() {
+  if (!makeCertificate()) {
+    printf("Can't generate certificate\nFAILED\n");
+    return 1;
+  }
+
+  struct {
+    const char *name;
+    int version;
+  } rounds[]{{"TLS 1.2", TLS1_2_VERSION}, {"TLS 1.3", TLS1_3_VERSION}};
+
+  bool passed{true};
+  uint16_t port{kPort};
+  for (const auto &round : rounds) {
+    // Each round on another port, a cached session is offered only to the
+    // same host and port
+    const int listener{openListener(port)};
+    if (listener == -1) {
+      printf("Can't listen on port %u\nFAILED\n", port);
+      return 1;
+    }
+    accepted = 0;
+    for (auto &resumed : serverResumed)
+      resumed = false;
+    std::thread server{runServer, listener, round.version};
+
+    WebSocketClient client;
+    client.setSecure(true, certificatePem.c_str());
+    int8_t resumed[kConnections];
+    for (auto &result : resumed)
+      result = connectOnce(client, port);
+
+    server.join();
+    close(listener);
+
+    printf("%s: resumed (client/server) %d/%d, then %d/%d\n", round.name,
+      resumed[0], serverResumed[0].load(), resumed[1],
+      serverResumed[1].load());
+    passed = passed && accepted == kConnections && resumed[0] == 0 &&
+             !serverResumed[0] && resumed[1] == 1 && serverResumed[1];
+    ++port;
+  }
+
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  printf(passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
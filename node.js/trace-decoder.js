@@ -0,0 +1,138 @@
+// Converts binary trace dump (see dumpTrace() in src/trace.h) into Chrome
+// trace-event JSON, open the result in chrome://tracing or ui.perfetto.dev
+//
+// Usage: node trace-decoder.js <dump.bin> [output.json]
+
+const FileSystem = require("fs");
+
+const kMagic = Buffer.from("WSTR");
+const kHeaderSize = 8;
+
+const kEvents = {
+  1: "FRAME_RX",
+  2: "FRAME_TX",
+  3: "STATE_CHANGE",
+  4: "HANDSHAKE_BEGIN",
+  5: "HANDSHAKE_STEP",
+  6: "HANDSHAKE_END",
+  7: "CALLBACK_BEGIN",
+  8: "CALLBACK_END",
+};
+const kOpcodes = {
+  0x00: "CONTINUATION",
+  0x01: "TEXT",
+  0x02: "BINARY",
+  0x08: "CLOSE",
+  0x09: "PING",
+  0x0a: "PONG",
+};
+const kReadyStates = ["CONNECTING", "OPEN", "CLOSING", "CLOSED"];
+
+function decode(data) {
+  // Dump might be surrounded by other serial output
+  const offset = data.indexOf(kMagic);
+  if (offset === -1) throw new Error("Trace header not found");
+
+  const version = data.readUInt8(offset + 4);
+  const recordSize = data.readUInt8(offset + 5);
+  const count = data.readUInt16LE(offset + 6);
+  if (version !== 1) throw new Error(`Unsupported version: ${version}`);
+
+  const records = [];
+  let previous = null;
+  let wraps = 0;
+  for (let i = 0; i < count; ++i) {
+    const at = offset + kHeaderSize + i * recordSize;
+    if (at + recordSize > data.length) break; // truncated dump
+
+    // micros() overflows every ~71 minutes
+    const timestamp = data.readUInt32LE(at);
+    if (previous !== null && timestamp < previous) ++wraps;
+    previous = timestamp;
+
+    records.push({
+      ts: wraps * 0x100000000 + timestamp,
+      source: data.readUInt16LE(at + 4),
+      event: kEvents[data.readUInt8(at + 6)] || "UNKNOWN",
+      arg: data.readUInt8(at + 7),
+      value: data.readUInt32LE(at + 8),
+    });
+  }
+  return records;
+}
+
+function toTraceEvent(record) {
+  const common = { pid: 1, tid: record.source, ts: record.ts };
+  const opcode = kOpcodes[record.arg] || `0x${record.arg.toString(16)}`;
+
+  switch (record.event) {
+    case "FRAME_RX":
+    case "FRAME_TX":
+      return {
+        ...common,
+        name: `${record.event === "FRAME_RX" ? "RX" : "TX"} ${opcode}`,
+        cat: "frame",
+        ph: "i",
+        s: "t",
+        args: { length: record.value },
+      };
+    case "STATE_CHANGE":
+      return {
+        ...common,
+        name: kReadyStates[record.arg] || "UNKNOWN",
+        cat: "state",
+        ph: "i",
+        s: "t",
+        args: { code: record.value },
+      };
+    case "HANDSHAKE_BEGIN":
+      return { ...common, name: "handshake", cat: "handshake", ph: "B" };
+    case "HANDSHAKE_STEP":
+      return {
+        ...common,
+        name: `line #${record.arg}`,
+        cat: "handshake",
+        ph: "i",
+        s: "t",
+        args: { length: record.value },
+      };
+    case "HANDSHAKE_END":
+      return {
+        ...common,
+        name: "handshake",
+        cat: "handshake",
+        ph: "E",
+        args: { status: record.value },
+      };
+    case "CALLBACK_BEGIN":
+      return {
+        ...common,
+        name: `onMessage ${opcode}`,
+        cat: "callback",
+        ph: "B",
+        args: { length: record.value },
+      };
+    case "CALLBACK_END":
+      return { ...common, name: `onMessage ${opcode}`, cat: "callback", ph: "E" };
+  }
+  return { ...common, name: record.event, ph: "i", s: "t" };
+}
+
+const [input, output] = process.argv.slice(2);
+if (!input) {
+  console.log("Usage: node trace-decoder.js <dump.bin> [output.json]");
+  process.exit(1);
+}
+
+const records = decode(FileSystem.readFileSync(input));
+const json = JSON.stringify({
+  traceEvents: records.map(toTraceEvent),
+  displayTimeUnit: "ms",
+});
+
+if (output) {
+  FileSystem.writeFileSync(output, json);
+  console.log(`${records.length} events written to ${output}`);
+} else {
+  console.log(json);
+}
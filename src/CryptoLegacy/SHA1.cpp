@@ -150,30 +150,86 @@ void SHA1::finalizeHMAC(const void *key, size_t keyLen, void *hash, size_t hashL
     clean(temp);
 }
 
+/**
+ * \brief Computes the SHA-1 hash of \a data in one step.
+ *
+ * \param data Points to the data to be hashed.
+ * \param len Number of bytes of data to be hashed.
+ * \param hash The buffer to return the 20-byte hash value in.
+ *
+ * Unlike update() and finalize() this doesn't need a SHA1 object, so there
+ * are no virtual calls and callers that only use digest() don't pull in the
+ * vtable (and HMAC support) of the Hash class.
+ */
+void SHA1::digest(const void *data, size_t len, void *hash)
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint32_t w[16];
+    const uint64_t length = ((uint64_t)len) << 3;
+
+    // Process all complete 512-bit chunks directly.
+    const uint8_t *d = (const uint8_t *)data;
+    for (; len >= 64; len -= 64, d += 64) {
+        memcpy(w, d, 64);
+        processChunk(h, w);
+    }
+
+    // Pad the last chunk.  We may need two padding chunks if there
+    // isn't enough room in the first for the padding and length.
+    uint8_t *wbytes = (uint8_t *)w;
+    memcpy(wbytes, d, len);
+    wbytes[len] = 0x80;
+    if (len <= (64 - 9)) {
+        memset(wbytes + len + 1, 0x00, 64 - 8 - (len + 1));
+    } else {
+        memset(wbytes + len + 1, 0x00, 64 - (len + 1));
+        processChunk(h, w);
+        memset(wbytes, 0x00, 64 - 8);
+    }
+    w[14] = htobe32((uint32_t)(length >> 32));
+    w[15] = htobe32((uint32_t)length);
+    processChunk(h, w);
+
+    // Convert the result into big endian and return it.
+    for (uint8_t posn = 0; posn < 5; ++posn)
+        w[posn] = htobe32(h[posn]);
+    memcpy(hash, w, 20);
+    clean(w);
+    clean(h);
+}
+
 /**
  * \brief Processes a single 512-bit chunk with the core SHA-1 algorithm.
+ */
+void SHA1::processChunk()
+{
+    processChunk(state.h, state.w);
+}
+
+/**
+ * \brief Processes the 512-bit chunk in \a w, updating the hash value \a h.
  *
  * Reference: http://en.wikipedia.org/wiki/SHA-1
  */
-void SHA1::processChunk()
+void SHA1::processChunk(uint32_t h[5], uint32_t w[16])
 {
     uint8_t index;
 
     // Convert the first 16 words from big endian to host byte order.
     for (index = 0; index < 16; ++index)
-        state.w[index] = be32toh(state.w[index]);
+        w[index] = be32toh(w[index]);
 
     // Initialize the hash value for this chunk.
-    uint32_t a = state.h[0];
-    uint32_t b = state.h[1];
-    uint32_t c = state.h[2];
-    uint32_t d = state.h[3];
-    uint32_t e = state.h[4];
+    uint32_t a = h[0];
+    uint32_t b = h[1];
+    uint32_t c = h[2];
+    uint32_t d = h[3];
+    uint32_t e = h[4];
 
     // Perform the first 16 rounds of the compression function main loop.
     uint32_t temp;
     for (index = 0; index < 16; ++index) {
-        temp = leftRotate5(a) + ((b & c) | ((~b) & d)) + e + 0x5A827999 + state.w[index];
+        temp = leftRotate5(a) + ((b & c) | ((~b) & d)) + e + 0x5A827999 + w[index];
         e = d;
         d = c;
         c = leftRotate30(b);
@@ -185,9 +241,9 @@ void SHA1::processChunk()
     // 80 in-place in the "w" array.  This saves 256 bytes of memory
     // that would have otherwise need to be allocated to the "w" array.
     for (; index < 20; ++index) {
-        temp = state.w[index & 0x0F] = leftRotate1
-            (state.w[(index - 3) & 0x0F] ^ state.w[(index - 8) & 0x0F] ^
-             state.w[(index - 14) & 0x0F] ^ state.w[(index - 16) & 0x0F]);
+        temp = w[index & 0x0F] = leftRotate1
+            (w[(index - 3) & 0x0F] ^ w[(index - 8) & 0x0F] ^
+             w[(index - 14) & 0x0F] ^ w[(index - 16) & 0x0F]);
         temp = leftRotate5(a) + ((b & c) | ((~b) & d)) + e + 0x5A827999 + temp;
         e = d;
         d = c;
@@ -196,9 +252,9 @@ void SHA1::processChunk()
         a = temp;
     }
     for (; index < 40; ++index) {
-        temp = state.w[index & 0x0F] = leftRotate1
-            (state.w[(index - 3) & 0x0F] ^ state.w[(index - 8) & 0x0F] ^
-             state.w[(index - 14) & 0x0F] ^ state.w[(index - 16) & 0x0F]);
+        temp = w[index & 0x0F] = leftRotate1
+            (w[(index - 3) & 0x0F] ^ w[(index - 8) & 0x0F] ^
+             w[(index - 14) & 0x0F] ^ w[(index - 16) & 0x0F]);
         temp = leftRotate5(a) + (b ^ c ^ d) + e + 0x6ED9EBA1 + temp;
         e = d;
         d = c;
@@ -207,9 +263,9 @@ void SHA1::processChunk()
         a = temp;
     }
     for (; index < 60; ++index) {
-        temp = state.w[index & 0x0F] = leftRotate1
-            (state.w[(index - 3) & 0x0F] ^ state.w[(index - 8) & 0x0F] ^
-             state.w[(index - 14) & 0x0F] ^ state.w[(index - 16) & 0x0F]);
+        temp = w[index & 0x0F] = leftRotate1
+            (w[(index - 3) & 0x0F] ^ w[(index - 8) & 0x0F] ^
+             w[(index - 14) & 0x0F] ^ w[(index - 16) & 0x0F]);
         temp = leftRotate5(a) + ((b & c) | (b & d) | (c & d)) + e + 0x8F1BBCDC + temp;
         e = d;
         d = c;
@@ -218,9 +274,9 @@ void SHA1::processChunk()
         a = temp;
     }
     for (; index < 80; ++index) {
-        temp = state.w[index & 0x0F] = leftRotate1
-            (state.w[(index - 3) & 0x0F] ^ state.w[(index - 8) & 0x0F] ^
-             state.w[(index - 14) & 0x0F] ^ state.w[(index - 16) & 0x0F]);
+        temp = w[index & 0x0F] = leftRotate1
+            (w[(index - 3) & 0x0F] ^ w[(index - 8) & 0x0F] ^
+             w[(index - 14) & 0x0F] ^ w[(index - 16) & 0x0F]);
         temp = leftRotate5(a) + (b ^ c ^ d) + e + 0xCA62C1D6 + temp;
         e = d;
         d = c;
@@ -230,11 +286,11 @@ void SHA1::processChunk()
     }
 
     // Add this chunk's hash to the result so far.
-    state.h[0] += a;
-    state.h[1] += b;
-    state.h[2] += c;
-    state.h[3] += d;
-    state.h[4] += e;
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
 
     // Attempt to clean up the stack.
     a = b = c = d = e = temp = 0;
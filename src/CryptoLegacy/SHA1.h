@@ -25,7 +25,7 @@
 
 #include "Hash.h"
 
-class SHA1 : public Hash
+class SHA1 final : public Hash
 {
 public:
     SHA1();
@@ -43,6 +43,8 @@ public:
     void resetHMAC(const void *key, size_t keyLen);
     void finalizeHMAC(const void *key, size_t keyLen, void *hash, size_t hashLen);
 
+    static void digest(const void *data, size_t len, void *hash);
+
 private:
     struct {
         uint32_t h[5];
@@ -52,6 +54,7 @@ private:
     } state;
 
     void processChunk();
+    static void processChunk(uint32_t h[5], uint32_t w[16]);
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "WebSocket.h"
-#include "CryptoLegacy/SHA1.h"
+#include "CryptoLegacy/Cipher.h"
 #include "base64/Base64.h"
+#include "digest.h"
 
 // https://tools.ietf.org/html/rfc6455
 
@@ -15,6 +16,16 @@ constexpr bool isControlFrame(uint8_t opcode) {
           (opcode == WebSocket::Opcode::PONG_FRAME) ||
           (opcode == WebSocket::Opcode::CONNECTION_CLOSE_FRAME));
 }
+/// Held back message: channel, data type, length (2 bytes), then payload.
+constexpr uint8_t kEntryHeaderSize{4};
+/// Outbound payload is encrypted/masked in chunks of this size (on stack).
+constexpr uint8_t kPayloadChunkSize{64};
+
+#ifdef _DISPATCH_THREAD
+/// Set while a message handler runs on the dispatch thread.
+thread_local bool dispatching{false};
+#endif
+
 constexpr bool isCloseCodeValid(uint16_t code) {
   // Inspired on "ws", Node.js WebSocket library
   // https://github.com/websockets/ws/blob/master/lib/validation.js
@@ -35,10 +46,9 @@ bool encodeSecKey(const char *key, char output[]) {
   memcpy(&buffer[0], key, kSecKeyLength);
   memcpy(&buffer[kSecKeyLength], kMagicString, kMagicStringLenght);
 
-  SHA1 sha1;
-  sha1.update(buffer, kBufferLength);
-  sha1.finalize(buffer, 20);
-  base64_encode(output, buffer, 20);
+  uint8_t hash[20];
+  sha1(buffer, kBufferLength, hash);
+  base64_encode(output, reinterpret_cast<const char *>(hash), 20);
   return true;
 }
 
@@ -49,55 +59,109 @@ void generateMask(char output[]) {
     output[i] = static_cast<char>(random(0xFF));
 }
 
+// Well-formed sequences (Unicode, Table 3-7): lead byte gives the amount of
+// continuation bytes (0x80..0xBF), only the first one has a narrower range to
+// reject overlongs, surrogates and code points above U+10FFFF.
+bool utf8_state_t::feed(uint8_t c) {
+  if (pending > 0) {
+    if (c < lower || c > upper) return false;
+    lower = 0x80;
+    upper = 0xBF;
+    --pending;
+  } else if (c >= 0x80) {
+    if (c < 0xC2 || c > 0xF4) return false;
+    pending = c < 0xE0 ? 1 : (c < 0xF0 ? 2 : 3);
+    if (c == 0xE0)
+      lower = 0xA0; // overlong
+    else if (c == 0xED)
+      upper = 0x9F; // surrogates
+    else if (c == 0xF0)
+      lower = 0x90; // overlong
+    else if (c == 0xF4)
+      upper = 0x8F; // > U+10FFFF
+  }
+  return true;
+}
+bool utf8_state_t::feed(const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; ++i)
+    if (!feed(data[i])) return false;
+  return true;
+}
+
+void token_bucket_t::reset(uint32_t rate) {
+  this->rate = rate;
+  tokens = rate;
+  lastRefill = millis();
+}
+bool token_bucket_t::take(uint32_t amount) {
+  if (rate == 0) return true;
+
+  const uint32_t now{millis()};
+  const uint64_t refill{static_cast<uint64_t>(now - lastRefill) * rate / 1000};
+  if (tokens + refill >= rate) {
+    tokens = rate;
+    lastRefill = now;
+  } else if (refill > 0) {
+    // Remainder (time of a fraction of a token) carries over
+    tokens += refill;
+    lastRefill += refill * 1000 / rate;
+  }
+  if (amount > tokens) return false;
+
+  tokens -= amount;
+  return true;
+}
+
+#ifdef _STATIC_MEMORY
+uint8_t *conflation_pool_t::acquire() {
+  for (uint8_t i = 0; i < kConflationPoolSize; ++i) {
+    if (!used[i]) {
+      used[i] = true;
+      return buffers[i];
+    }
+  }
+  return nullptr;
+}
+void conflation_pool_t::release(uint8_t *buffer) {
+  used[(buffer - buffers[0]) / kConflationBufferSize] = false;
+}
+#endif
+
+bool isValidUTF8(const byte *s, size_t length) {
+  utf8_state_t state;
+  return state.feed(s, length) && state.isComplete();
+}
+
 /**
- * @see
- * https://github.com/websockets/utf-8-validate/blob/master/src/validation.c
+ * @brief First stages of receive pipeline fused into one pass: unmasks chunk
+ * in place and validates it (if given a validator).
+ * @param keyOffset Position in masking key, advanced by chunk length.
  */
-bool isValidUTF8(const byte *s, size_t length) {
-  const uint8_t *end{s + length};
-
-  //
-  // This code has been taken from utf8_check.c which was developed by
-  // Markus Kuhn <http://www.cl.cam.ac.uk/~mgk25/>.
-  //
-  // For original code / licensing please refer to
-  // https://www.cl.cam.ac.uk/%7Emgk25/ucs/utf8_check.c
-  //
-  while (s < end) {
-    if (*s < 0x80) { // 0xxxxxxx
-      s++;
-    } else if ((s[0] & 0xe0) == 0xc0) { // 110xxxxx 10xxxxxx
-      if (s + 1 == end || (s[1] & 0xc0) != 0x80 ||
-          (s[0] & 0xfe) == 0xc0 // overlong
-      ) {
-        break;
-      } else {
-        s += 2;
-      }
-    } else if ((s[0] & 0xf0) == 0xe0) { // 1110xxxx 10xxxxxx 10xxxxxx
-      if (s + 2 >= end || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 ||
-          (s[0] == 0xe0 && (s[1] & 0xe0) == 0x80) ||
-          (s[0] == 0xed && (s[1] & 0xe0) == 0xa0)) {
-        break;
-      } else {
-        s += 3;
-      }
-    } else if ((s[0] & 0xf8) == 0xf0) { // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-      if (s + 3 >= end || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 ||
-          (s[3] & 0xc0) != 0x80 ||
-          (s[0] == 0xf0 && (s[1] & 0xf0) == 0x80) ||   // overlong
-          (s[0] == 0xf4 && s[1] > 0x8f) || s[0] > 0xf4 // > U+10FFFF
-      ) {
-        break;
-      } else {
-        s += 4;
-      }
-    } else {
-      break;
-    }
+bool unmaskChunk(uint8_t *data, size_t length, const uint8_t key[],
+  uint8_t &keyOffset, utf8_state_t *utf8) {
+  uint8_t rotatedKey[4];
+  for (uint8_t i = 0; i < 4; ++i)
+    rotatedKey[i] = key[(keyOffset + i) % 4];
+  uint32_t wordKey;
+  memcpy(&wordKey, rotatedKey, 4);
+
+  size_t i{0};
+  for (; i + 4 <= length; i += 4) {
+    uint32_t word;
+    memcpy(&word, data + i, 4);
+    word ^= wordKey;
+    memcpy(data + i, &word, 4);
+    // Whole word of ASCII between sequences needs no decoding
+    if (utf8 && (utf8->pending > 0 || (word & 0x80808080UL)))
+      if (!utf8->feed(data + i, 4)) return false;
+  }
+  for (; i < length; ++i) {
+    data[i] ^= rotatedKey[i % 4];
+    if (utf8 && !utf8->feed(data[i])) return false;
   }
 
-  return s == end;
+  keyOffset = (keyOffset + length) % 4;
+  return true;
 }
 
 //
@@ -138,34 +202,40 @@ struct WebSocket::header_t {
 // WebSocket class implementation (public):
 //
 
-WebSocket::~WebSocket() { terminate(); }
+WebSocket::~WebSocket() {
+  _terminate();
+#ifdef _THREAD_SAFE_SEND
+  for (shared_message_t **entry; (entry = m_posted.front()); m_posted.pop())
+    (*entry)->release();
+#endif
+#ifdef _STATIC_MEMORY
+  if (m_conflated) m_conflationPool->release(m_conflated);
+#else
+  SAFE_DELETE_ARRAY(m_conflated);
+#endif
+}
 
 void WebSocket::close(
   const CloseCode code, bool instant, const char *reason, uint16_t length) {
-  if (m_readyState != ReadyState::OPEN) return;
   if (length > 123) {
     // #TODO Trigger error ...
     return;
   }
-
-  m_readyState = ReadyState::CLOSING;
-  char buffer[128]{
-    static_cast<char>((code >> 8) & 0xFF), static_cast<char>(code & 0xFF)};
-
-  if (length) memcpy(&buffer[2], reason, length);
-  _send(CONNECTION_CLOSE_FRAME, true, m_maskEnabled, buffer, 2 + length);
-
-  if (instant) {
-    terminate();
-    if (_onClose) _onClose(*this, code, reason, length);
+#ifdef _DISPATCH_THREAD
+  if (m_outbound && _isDispatching()) {
+    const char codeBytes[2]{
+      static_cast<char>((code >> 8) & 0xFF), static_cast<char>(code & 0xFF)};
+    const Slice parts[]{{codeBytes, 2}, {reason, length}};
+    return _enqueue(
+      *m_outbound, this, CONNECTION_CLOSE_FRAME, instant, parts, 2);
   }
+#endif
+  m_closedByUser = true;
+  _close(code, instant, reason, length);
 }
 void WebSocket::terminate() {
-  m_client.flush();
-  m_client.stop();
-  m_readyState = ReadyState::CLOSED;
-  SAFE_DELETE_ARRAY(m_protocol);
-  _clearDataBuffer();
+  m_closedByUser = true;
+  _terminate();
 }
 
 WebSocket::ReadyState WebSocket::getReadyState() const { return m_readyState; }
@@ -174,19 +244,89 @@ bool WebSocket::isAlive() const {
 }
 
 IPAddress WebSocket::getRemoteIP() const { return fetchRemoteIp(m_client); }
-const char *WebSocket::getProtocol() const { return m_protocol; }
+const char *WebSocket::getProtocol() const {
+#ifdef _STATIC_MEMORY
+  return *m_protocol ? m_protocol : nullptr;
+#else
+  return m_protocol;
+#endif
+}
+
+#ifdef _COLLECT_STATS
+const WebSocketStats &WebSocket::getStats() const { return m_stats; }
+#endif
 
 void WebSocket::send(
   const WebSocket::DataType dataType, const char *message, uint16_t length) {
+  const Slice part{message, length};
+  send(dataType, &part, 1);
+}
+void WebSocket::send(
+  const WebSocket::DataType dataType, const Slice parts[], uint8_t count) {
+  const uint8_t opcode{static_cast<uint8_t>(
+    dataType == DataType::TEXT ? TEXT_FRAME : BINARY_FRAME)};
+#ifdef _DISPATCH_THREAD
+  if (m_outbound && _isDispatching())
+    return _enqueue(*m_outbound, this, opcode, 0, parts, count);
+#endif
   if (m_readyState != ReadyState::OPEN) {
     // #TODO Trigger error ...
     return;
   }
 
-  _send(dataType == DataType::TEXT ? TEXT_FRAME : BINARY_FRAME, true,
-    m_maskEnabled, message, length);
+  uint32_t totalLength{0};
+  for (uint8_t i = 0; i < count; ++i)
+    totalLength += parts[i].length;
+  if (totalLength > 0xFFFF) {
+    // #TODO Trigger error ...
+    return;
+  }
+  const uint16_t length = totalLength;
+
+  if (kMaxFragmentSize == 0 || length <= kMaxFragmentSize)
+    return _send(opcode, true, m_maskEnabled, parts, count, 0, length);
+
+  // Control frames may be injected between fragments (RFC 6455, 5.4), so a
+  // ping doesn't have to wait for the whole message
+  for (uint16_t offset = 0; offset < length; offset += kMaxFragmentSize) {
+    const uint16_t size = length - offset < kMaxFragmentSize
+                            ? length - offset
+                            : kMaxFragmentSize;
+    const bool fin{offset + size == length};
+    _send(offset == 0 ? opcode : static_cast<uint8_t>(CONTINUATION_FRAME),
+      fin, m_maskEnabled, parts, count, offset, size);
+    if (fin) break;
+
+    _handleControlFrames();
+    if (m_readyState != ReadyState::OPEN || m_deferredClose) return;
+  }
+}
+void WebSocket::send(const FrameHeader &header, const char *message) {
+#ifdef _DISPATCH_THREAD
+  if (m_outbound && _isDispatching()) {
+    const Slice part{message, header.length};
+    return _enqueue(*m_outbound, this, header.bytes[0] & 0x0F, 0, &part, 1);
+  }
+#endif
+  if (m_readyState != ReadyState::OPEN) {
+    // #TODO Trigger error ...
+    return;
+  }
+
+  uint8_t encoded[kMaxFrameHeaderSize];
+  memcpy(encoded, header.bytes, sizeof(encoded));
+  if (m_maskEnabled) encoded[1] |= 0x80;
+
+  const Slice part{message, header.length};
+  _sendFrame(encoded, header.size, &part, 1, 0, header.length);
 }
 void WebSocket::ping(const char *payload, uint16_t length) {
+#ifdef _DISPATCH_THREAD
+  if (m_outbound && _isDispatching()) {
+    const Slice part{payload, length};
+    return _enqueue(*m_outbound, this, PING_FRAME, 0, &part, 1);
+  }
+#endif
   if (m_readyState != ReadyState::OPEN) {
     // #TODO Trigger error ...
     return;
@@ -194,6 +334,13 @@ void WebSocket::ping(const char *payload, uint16_t length) {
 
   _send(PING_FRAME, true, m_maskEnabled, payload, length);
 }
+#ifdef _THREAD_SAFE_SEND
+bool WebSocket::post(
+  const DataType dataType, const char *message, uint16_t length) {
+  return _post(m_posted, kBroadcastChannel, dataType, message, length);
+}
+uint32_t WebSocket::getId() const { return m_id; }
+#endif
 
 void WebSocket::onClose(const onCloseCallback &callback) {
   _onClose = callback;
@@ -203,16 +350,112 @@ void WebSocket::onMessage(const onMessageCallback &callback) {
 }
 void WebSocket::onPing(const onPingCallback &callback) { _onPing = callback; }
 
+void WebSocket::setUserData(void *data) { m_userData = data; }
+void *WebSocket::getUserData() const { return m_userData; }
+
+void WebSocket::setCipher(Cipher *outbound, Cipher *inbound) {
+  m_outboundCipher = outbound;
+  m_inboundCipher = inbound;
+}
+
+void WebSocket::setRateLimit(uint16_t messages, uint32_t bytes) {
+  m_messageBucket.reset(messages);
+  m_byteBucket.reset(bytes);
+}
+
+void WebSocket::setOverflowPolicy(OverflowPolicy policy, uint16_t threshold) {
+  m_overflowPolicy = policy;
+  m_backlogThreshold = threshold;
+  if (policy != OverflowPolicy::CONFLATE || m_conflated) return;
+#ifdef _STATIC_MEMORY
+  if (m_conflationPool) m_conflated = m_conflationPool->acquire();
+  if (!m_conflated) {
+    __debugOutput(F("No conflation buffer left\n"));
+  }
+#else
+  m_conflated = new uint8_t[kConflationBufferSize];
+#endif
+}
+
+#ifdef _CORK
+void WebSocket::cork() { m_corked = true; }
+void WebSocket::uncork() {
+  m_corked = false;
+  _flushOutput();
+}
+void WebSocket::setAutoCork(bool enabled) {
+  m_autoCork = enabled;
+  if (!enabled) _flushOutput();
+}
+#endif
+
 //
 // Protected:
 //
 
 WebSocket::WebSocket(const NetClient &client, const char *protocol)
   : m_client{client}, m_readyState{ReadyState::OPEN}, m_maskEnabled{false} {
+  __statsUpdate(m_stats.connections = 1);
+  __traceEvent(STATE_CHANGE, static_cast<uint8_t>(m_readyState), 0);
   if (protocol) {
+#ifdef _STATIC_MEMORY
+    // WebSocketServer rejects longer ones during handshake
+    strncpy(m_protocol, protocol, kProtocolMaxSize - 1);
+#else
     m_protocol = new char[strlen(protocol) + 1];
     strcpy(m_protocol, protocol);
+#endif
+  }
+}
+
+void WebSocket::_close(
+  const CloseCode code, bool instant, const char *reason, uint16_t length) {
+  if (m_readyState != ReadyState::OPEN) return;
+  if (m_betweenFragments) {
+    // Inside send() (maybe called by onMessage, which still reads the data
+    // buffer), the next listen() closes the connection
+    if (!m_deferredClose) m_deferredClose = code;
+    return;
   }
+
+  __statsUpdate(if (code == PROTOCOL_ERROR ||
+                    code == INVALID_FRAME_PAYLOAD_DATA) ++m_stats.protocolErrors);
+
+  m_readyState = ReadyState::CLOSING;
+  m_closingStart = millis();
+  __traceEvent(STATE_CHANGE, static_cast<uint8_t>(m_readyState), code);
+  char buffer[128]{
+    static_cast<char>((code >> 8) & 0xFF), static_cast<char>(code & 0xFF)};
+
+  if (length) memcpy(&buffer[2], reason, length);
+  _send(CONNECTION_CLOSE_FRAME, true, m_maskEnabled, buffer, 2 + length);
+#ifdef _CORK
+  _flushOutput();
+#endif
+
+  if (instant) {
+    _terminate();
+    if (_onClose) {
+      __statsTimeCallback(m_stats, _onClose(*this, code, reason, length));
+    }
+  }
+}
+void WebSocket::_terminate() {
+#ifdef _CORK
+  _flushOutput();
+#endif
+  m_client.flush();
+  m_client.stop();
+  m_readyState = ReadyState::CLOSED;
+  __traceEvent(STATE_CHANGE, static_cast<uint8_t>(m_readyState), 0);
+#ifdef _STATIC_MEMORY
+  m_protocol[0] = '\0';
+#else
+  SAFE_DELETE_ARRAY(m_protocol);
+#endif
+  _clearDataBuffer();
+  m_conflatedSize = 0;
+  m_deferredClose = 0;
 }
 
 int32_t WebSocket::_read() {
@@ -222,67 +465,141 @@ int32_t WebSocket::_read() {
   }
 
   if (millis() > timeout) {
-    close(PROTOCOL_ERROR, true);
+    _close(PROTOCOL_ERROR, true);
     return -1;
   }
 
+  __statsUpdate(++m_stats.bytesIn);
   return m_client.read();
 }
 bool WebSocket::_read(char *buffer, size_t size, size_t offset) {
-  size_t counter{0};
-  int32_t bite{-1};
-  do {
-    if ((bite = _read()) == -1) return false;
-    buffer[offset + (counter++)] = bite;
-  } while (counter != size);
+  for (int32_t n{0}; size > 0; offset += n, size -= n)
+    if ((n = _readSome(buffer + offset, size)) == -1) return false;
 
   return true;
 }
+int32_t WebSocket::_readSome(char *buffer, size_t size) {
+  int available{m_client.available()};
+  if (available <= 0) {
+    const uint32_t timeout{millis() + kTimeoutInterval};
+    while ((available = m_client.available()) <= 0 && millis() < timeout) {
+      delay(1);
+    }
+
+    if (available <= 0) {
+      _close(PROTOCOL_ERROR, true);
+      return -1;
+    }
+  }
+
+  const auto n = m_client.read(reinterpret_cast<uint8_t *>(buffer),
+    size < static_cast<size_t>(available) ? size : available);
+  if (n <= 0) {
+    _close(PROTOCOL_ERROR, true);
+    return -1;
+  }
+  __statsUpdate(m_stats.bytesIn += n);
+  return n;
+}
+
+uint8_t WebSocket::_encodeHeader(
+  uint8_t opcode, bool fin, bool mask, uint16_t length, uint8_t header[]) {
+  const auto encoded = _makeHeader(opcode, fin, mask, length);
+  memcpy(header, encoded.bytes, encoded.size);
+  return encoded.size;
+}
 
 void WebSocket::_send(
   uint8_t opcode, bool fin, bool mask, const char *data, uint16_t length) {
-  uint16_t bytesWritten{0};
-  bytesWritten += m_client.write(opcode | (fin ? 0x80 : 0x00));
-
-  if (length <= 125) {
-    bytesWritten +=
-      m_client.write((mask ? 0x80 : 0x00) | static_cast<char>(length));
-  } else if (length <= 0xFFFF) {
-    bytesWritten += m_client.write((mask ? 0x80 : 0x00) | 126);
-    bytesWritten += m_client.write(static_cast<char>(length >> 8) & 0xFF);
-    bytesWritten += m_client.write(static_cast<char>(length & 0xFF));
-  } else
-    return; // too big ...
+  const Slice part{data, length};
+  _send(opcode, fin, mask, &part, 1, 0, length);
+}
+void WebSocket::_send(uint8_t opcode, bool fin, bool mask, const Slice parts[],
+  uint8_t count, uint16_t offset, uint16_t length) {
+  uint8_t header[kMaxFrameHeaderSize]{};
+  const auto headerSize = _encodeHeader(opcode, fin, mask, length, header);
+  _sendFrame(header, headerSize, parts, count, offset, length);
+}
+void WebSocket::_sendFrame(const uint8_t header[], uint8_t headerSize,
+  const Slice parts[], uint8_t count, uint16_t offset, uint16_t length) {
+  const uint8_t opcode = header[0] & 0x0F;
+  const bool mask{(header[1] & 0x80) != 0};
 
 #ifdef _DUMP_HEADER
   printf(F("TX FRAME : OPCODE=%u, FIN=%s, RSV=0, PAYLOAD-LEN=%u, MASK="),
-    opcode, fin ? "True" : "False", length);
+    opcode, header[0] & 0x80 ? "True" : "False", length);
 #endif
 
-  if (mask) {
-    char maskingKey[4]{};
-    generateMask(maskingKey);
+  char maskingKey[4]{};
+  if (mask) generateMask(maskingKey);
 
 #ifdef _DUMP_HEADER
+  if (mask)
     printf(F("%x%x%x%x\n"), maskingKey[0], maskingKey[1], maskingKey[2],
       maskingKey[3]);
-#endif
-
-    bytesWritten += m_client.write(maskingKey, 4);
-    for (uint16_t i = 0; i < length; ++i)
-      bytesWritten +=
-        m_client.write(static_cast<char>(data[i] ^ maskingKey[i % 4]));
-  } else {
-#ifdef _DUMP_HEADER
+  else
     printf(F("None\n"));
 #endif
 
-    if (length) {
-      bytesWritten +=
-        m_client.write(reinterpret_cast<const char *>(data), length);
+#ifdef _CORK
+  _beginFrame(headerSize + (mask ? 4 : 0) + length);
+#endif
+  uint16_t bytesWritten{0};
+  bytesWritten += _write(header, headerSize);
+  if (mask) bytesWritten += _write(maskingKey, 4);
+
+  const bool encrypt{m_outboundCipher && !isControlFrame(opcode)};
+  const char *payload{nullptr};
+  // Position in frame payload, the masking key continues across parts
+  uint16_t position{0};
+  for (uint8_t i = 0; i < count && position < length; ++i) {
+    if (offset >= parts[i].length) {
+      offset -= parts[i].length;
+      continue;
     }
+    const char *data{parts[i].data + offset};
+    const uint16_t size = parts[i].length - offset < length - position
+                            ? parts[i].length - offset
+                            : length - position;
+    offset = 0;
+    if (!payload) payload = data;
+
+    bytesWritten += _writePayload(
+      data, size, encrypt, mask ? maskingKey : nullptr, position);
+    position += size;
   }
 
+  _onFrameSent(opcode, payload, length, bytesWritten);
+}
+void WebSocket::_sendEncoded(const uint8_t header[], uint8_t headerSize,
+  const char *data, uint16_t length) {
+#ifdef _CORK
+  _beginFrame(headerSize + length);
+#endif
+  uint16_t bytesWritten{0};
+  bytesWritten += _write(header, headerSize);
+  if (length) {
+    const bool encrypt{
+      m_outboundCipher && !isControlFrame(header[0] & 0x0F)};
+    bytesWritten += _writePayload(data, length, encrypt, nullptr, 0);
+  }
+
+  _onFrameSent(header[0] & 0x0F, data, length, bytesWritten);
+}
+void WebSocket::_onFrameSent(
+  uint8_t opcode, const char *data, uint16_t length, uint16_t bytesWritten) {
+  // Used only by trace, stats and dumps
+  (void)opcode, (void)data, (void)length, (void)bytesWritten;
+  __traceEvent(FRAME_TX, opcode, length);
+#ifdef _TLS
+  // Seal the whole frame into a single record
+#  ifdef _CORK
+  if (m_client.isSecure() && !_isCorked()) m_client.flush();
+#  else
+  if (m_client.isSecure()) m_client.flush();
+#  endif
+#endif
+
 #ifdef _DUMP_FRAME_DATA
   if (length) printf(F("%s\n"), data);
 #endif
@@ -290,33 +607,128 @@ void WebSocket::_send(
 #ifdef _DUMP_HEADER
   printf(F("TX BYTES = %u\n"), bytesWritten);
 #endif
+
+  __statsUpdate(m_stats.bytesOut += bytesWritten);
+  __statsUpdate(++m_stats.framesOut);
+  __statsUpdate(if (isControlFrame(opcode)) ++m_stats.controlFramesOut);
+#ifdef _CORK
+  m_uncorkedFrame = false;
+#endif
 }
 
+size_t WebSocket::_write(const void *data, size_t size) {
+#ifdef _CORK
+  if (_isCorked()) {
+    if (m_outputSize + size > kCorkBufferSize) _flushOutput();
+    if (size <= kCorkBufferSize) {
+      memcpy(m_output + m_outputSize, data, size);
+      m_outputSize += size;
+      return size;
+    }
+  }
+#endif
+  __statsUpdate(++m_stats.writes);
+  return m_client.write(static_cast<const uint8_t *>(data), size);
+}
+size_t WebSocket::_writePayload(const char *data, uint16_t size, bool encrypt,
+  const char maskingKey[], uint16_t position) {
+  if (!encrypt && !maskingKey) return _write(data, size);
+
+  // Each chunk goes through all stages while it's in cache: the cipher writes
+  // it to the chunk buffer (or it's copied there), then it's masked in place
+  uint8_t chunk[kPayloadChunkSize];
+  uint8_t keyOffset = position % 4;
+  size_t bytesWritten{0};
+  for (uint16_t n{0}; size > 0; data += n, size -= n) {
+    n = size < kPayloadChunkSize ? size : kPayloadChunkSize;
+    const auto input = reinterpret_cast<const uint8_t *>(data);
+    if (encrypt)
+      m_outboundCipher->encrypt(chunk, input, n);
+    else
+      memcpy(chunk, input, n);
+    if (maskingKey) {
+      // Masking is the same XOR as unmasking
+      unmaskChunk(chunk, n, reinterpret_cast<const uint8_t *>(maskingKey),
+        keyOffset, nullptr);
+    }
+    bytesWritten += _write(chunk, n);
+  }
+  return bytesWritten;
+}
+#ifdef _CORK
+bool WebSocket::_isCorked() const {
+  return (m_corked || m_autoCork) && !m_uncorkedFrame;
+}
+void WebSocket::_beginFrame(size_t size) {
+  // Frames are collected whole, so m_output always starts at a frame boundary
+  // (where _sendPong() puts its pong). Otherwise a flush in the middle of a
+  // frame would leave its tail at the front.
+  if (!_isCorked()) return;
+  if (m_outputSize + size > kCorkBufferSize) _flushOutput();
+  m_uncorkedFrame = size > kCorkBufferSize;
+}
+void WebSocket::_flushOutput() {
+  if (m_outputSize == 0) return;
+
+  __statsUpdate(++m_stats.writes);
+  m_client.write(m_output, m_outputSize);
+  if (m_pongSize) {
+    // Not counted by _sendPong(), a waiting pong may be replaced
+    __traceEvent(FRAME_TX, PONG_FRAME, m_pongLength);
+    __statsUpdate(m_stats.bytesOut += m_pongSize);
+    __statsUpdate(++m_stats.framesOut);
+    __statsUpdate(++m_stats.controlFramesOut);
+  }
+  m_outputSize = 0;
+  m_pongSize = 0;
+#  ifdef _TLS
+  if (m_client.isSecure()) m_client.flush();
+#  endif
+}
+#endif
+
 void WebSocket::_readFrame() {
-  if (m_readyState == ReadyState::CLOSED) return;
+  if (m_readyState == ReadyState::CLOSED || m_deferredClose) return;
 
   header_t header;
   if (!_readHeader(header)) return;
 
-  bool usingTempBuffer = isControlFrame(header.opcode);
+  const bool isControl = isControlFrame(header.opcode);
+  __statsUpdate(++m_stats.framesIn);
+  __statsUpdate(if (isControl) ++m_stats.controlFramesIn);
+  // Control frames can't be fragmented and are limited to 125 bytes, hence
+  // they don't use (and can't break) the data buffer
+  char controlPayload[126]{};
   char *payload{nullptr};
   size_t offset{0};
 
-  if (usingTempBuffer) {
-    payload = new char[header.length + 1]{};
+  if (isControl) {
+    payload = controlPayload;
   } else {
     payload = m_dataBuffer;
     offset = m_currentOffset;
 
     if (header.length + offset >= kBufferMaxSize)
-      return close(CloseCode::MESSAGE_TOO_BIG, true);
+      return _close(CloseCode::MESSAGE_TOO_BIG, true);
+  }
+  if (!m_byteBucket.take(header.length) ||
+      (header.fin && !m_messageBucket.take(1))) {
+    __debugOutput(F("Rate limit exceeded, closing connection\n"));
+    return _close(CloseCode::POLICY_VIOLATION, true);
+  }
+
+  // Text message is validated as it arrives (across its fragments)
+  utf8_state_t *utf8{nullptr};
+  if (header.opcode == Opcode::TEXT_FRAME) {
+    m_utf8 = {};
+    utf8 = &m_utf8;
+  } else if (header.opcode == Opcode::CONTINUATION_FRAME &&
+             m_tbcOpcode == Opcode::TEXT_FRAME) {
+    utf8 = &m_utf8;
   }
 
   if (header.length > 0) {
-    if (!_readData(header, payload, offset)) {
-      if (usingTempBuffer) SAFE_DELETE_ARRAY(payload);
-      return;
-    }
+    if (!_readData(header, payload, offset, utf8)) return;
   }
 
   switch (header.opcode) {
@@ -334,9 +746,9 @@ void WebSocket::_readFrame() {
     break;
   }
   case Opcode::PING_FRAME: {
-    _send(PONG_FRAME, true, m_maskEnabled, payload, header.length);
+    _sendPong(payload, header.length);
     if (_onPing) {
-      _onPing(*this, payload, header.length);
+      __statsTimeCallback(m_stats, _onPing(*this, payload, header.length));
     }
     break;
   }
@@ -345,13 +757,275 @@ void WebSocket::_readFrame() {
   }
   default: {
     __debugOutput(F("Unrecognized frame opcode: %u\n"), header.opcode);
-    close(PROTOCOL_ERROR, true);
+    _close(PROTOCOL_ERROR, true);
     break;
   }
   }
+}
+void WebSocket::_handleControlFrames() {
+  char pongPayload[126]{};
+  int16_t pongLength{-1};
+
+  // A close frame stays in the input for the next listen(), errors (and
+  // close() called by onPing) are deferred until then too
+  m_betweenFragments = true;
+  while (m_readyState == ReadyState::OPEN && !m_deferredClose &&
+         m_client.available() >= 2 &&
+         (m_client.peek() & 0x0F) != CONNECTION_CLOSE_FRAME &&
+         isControlFrame(m_client.peek() & 0x0F)) {
+    header_t header;
+    if (!_readHeader(header)) break;
+
+    __statsUpdate(++m_stats.framesIn);
+    __statsUpdate(++m_stats.controlFramesIn);
+    char payload[126]{};
+    if (header.length > 0 && !_readData(header, payload)) break;
+
+    if (header.opcode == Opcode::PING_FRAME) {
+      memcpy(pongPayload, payload, header.length);
+      pongLength = header.length;
+      if (_onPing) {
+        __statsTimeCallback(m_stats, _onPing(*this, payload, header.length));
+      }
+    }
+  }
+  m_betweenFragments = false;
+
+  if (pongLength != -1 && m_readyState == ReadyState::OPEN && !m_deferredClose)
+    _sendPong(pongPayload, pongLength);
+}
+void WebSocket::_sendPong(const char *payload, uint16_t length) {
+#ifdef _CORK
+  static_assert(kCorkBufferSize >= kMaxFrameHeaderSize + 4 + 125,
+    "Cork buffer can't hold a control frame");
+  if (_isCorked()) {
+    // Collected frames are complete (see _beginFrame()), so the pong can go
+    // ahead of them.
+    // A pong that is still waiting is replaced (only the latest ping needs
+    // an answer).
+    uint8_t frame[kMaxFrameHeaderSize + 4 + 125];
+    uint8_t size{_encodeHeader(PONG_FRAME, true, m_maskEnabled, length, frame)};
+    if (m_maskEnabled) {
+      char maskingKey[4]{};
+      generateMask(maskingKey);
+      memcpy(frame + size, maskingKey, 4);
+      size += 4;
+      for (uint16_t i = 0; i < length; ++i)
+        frame[size + i] = payload[i] ^ maskingKey[i % 4];
+    } else {
+      memcpy(frame + size, payload, length);
+    }
+    size += length;
+
+    m_outputSize -= m_pongSize;
+    memmove(m_output, m_output + m_pongSize, m_outputSize);
+    m_pongSize = 0;
+    if (m_outputSize + size > kCorkBufferSize) _flushOutput();
+    memmove(m_output + size, m_output, m_outputSize);
+    memcpy(m_output, frame, size);
+    m_outputSize += size;
+    m_pongSize = size;
+    m_pongLength = static_cast<uint8_t>(length);
+    return;
+  }
+#endif
+  _send(PONG_FRAME, true, m_maskEnabled, payload, length);
+}
+void WebSocket::_deliverMessage(uint8_t opcode, uint16_t length) {
+  __statsUpdate(++m_stats.messagesDelivered);
+  __statsUpdate(m_stats.recordPayload(length));
+  if (!_onMessage) return;
+
+#ifdef _DISPATCH_THREAD
+  if (m_inbound) {
+    // WebSocketServer::listen() reads a frame only if there is a free entry
+    auto entry = m_inbound->back();
+    entry->ws = this;
+    entry->opcode = opcode;
+    entry->arg = 0;
+    entry->length = length;
+    memcpy(entry->data, m_dataBuffer, length);
+    ++m_pending;
+    m_inbound->push();
+    return;
+  }
+#endif
+  const auto dataType =
+    opcode == TEXT_FRAME ? DataType::TEXT : DataType::BINARY;
+  __traceEvent(CALLBACK_BEGIN, opcode, length);
+  __statsTimeCallback(
+    m_stats, _onMessage(*this, dataType, m_dataBuffer, length));
+  __traceEvent(CALLBACK_END, opcode, length);
+}
+#ifdef _DISPATCH_THREAD
+bool WebSocket::_isDispatching() { return dispatching; }
+void WebSocket::_dispatch(const dispatch_entry_t &entry) {
+  // Trace buffer isn't shared between threads, hence no callback events
+  const auto dataType =
+    entry.opcode == TEXT_FRAME ? DataType::TEXT : DataType::BINARY;
+  if (!_onMessage) return;
+
+  // m_stats belongs to the I/O thread, WebSocketServer::dispatch() measures
+  // the handler
+  dispatching = true;
+  _onMessage(*this, dataType, entry.data, entry.length);
+  dispatching = false;
+}
+void WebSocket::_enqueue(DispatchQueue &queue, WebSocket *ws, uint8_t opcode,
+  uint8_t arg, const Slice parts[], uint8_t count) {
+  uint32_t length{0};
+  for (uint8_t i = 0; i < count; ++i)
+    length += parts[i].length;
+  if (length > kBufferMaxSize) {
+    __debugOutput(F("Request too long for dispatch queue: %u\n"),
+      static_cast<unsigned>(length));
+    return;
+  }
+
+  dispatch_entry_t *entry{nullptr};
+  // I/O thread drains the queue in every listen() call
+  while (!(entry = queue.back()))
+    delay(1);
+
+  entry->ws = ws;
+  entry->opcode = opcode;
+  entry->arg = arg;
+  entry->length = length;
+  char *data{entry->data};
+  for (uint8_t i = 0; i < count; ++i) {
+    if (parts[i].length) memcpy(data, parts[i].data, parts[i].length);
+    data += parts[i].length;
+  }
+  if (ws) ++ws->m_pending;
+  queue.push();
+}
+#endif
+#ifdef _THREAD_SAFE_SEND
+bool WebSocket::_post(PostQueue &queue, uint8_t channel,
+  const DataType dataType, const char *message, uint16_t length,
+  uint32_t recipient) {
+  auto shared = shared_message_t::create(channel, dataType, message, length);
+  shared->recipient = recipient;
+  if (queue.push(shared)) return true;
+
+  shared->release();
+  return false;
+}
+void WebSocket::_flushPosted() {
+  while (auto entry = m_posted.front()) {
+    // Popped first, producers get the slot back while this one is sent
+    auto shared = *entry;
+    m_posted.pop();
+    send(shared->dataType, shared->data(), shared->length);
+    shared->release();
+  }
+}
+#endif
+#if defined(_SHARDING) || defined(_THREAD_SAFE_SEND)
+shared_message_t *shared_message_t::create(uint8_t channel,
+  const WebSocket::DataType dataType, const char *message, uint16_t length) {
+  auto shared =
+    new (new uint8_t[sizeof(shared_message_t) + length]) shared_message_t;
+  shared->refs.store(1, std::memory_order_relaxed);
+  shared->dataType = dataType;
+  shared->channel = channel;
+  shared->length = length;
+#  ifdef _THREAD_SAFE_SEND
+  shared->recipient = 0;
+#  endif
+  if (length) memcpy(shared->data(), message, length);
+  return shared;
+}
+void shared_message_t::release() {
+  if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  this->~shared_message_t();
+  delete[] reinterpret_cast<uint8_t *>(this);
+}
+#endif
+bool WebSocket::_isBacklogged(uint16_t frameSize) const {
+#ifdef _CORK
+  // Collected frames are written ahead of this one
+  return isBacklogged(m_client, m_outputSize + frameSize, m_backlogThreshold);
+#else
+  return isBacklogged(m_client, frameSize, m_backlogThreshold);
+#endif
+}
+bool WebSocket::_admitMessage(uint8_t channel, const DataType dataType,
+  const char *message, uint16_t length, uint16_t frameSize) {
+  switch (m_overflowPolicy) {
+  case OverflowPolicy::NONE:
+    return true;
+  case OverflowPolicy::DROP_NEWEST:
+    if (!_isBacklogged(frameSize)) return true;
+    __statsUpdate(++m_stats.droppedMessages);
+    return false;
+  case OverflowPolicy::CONFLATE:
+    // Held back messages go first (or get replaced by this one)
+    _flushConflated();
+    if (m_conflatedSize == 0 && !_isBacklogged(frameSize)) return true;
+    _conflate(channel, dataType, message, length);
+    return false;
+  case OverflowPolicy::DISCONNECT:
+    if (!_isBacklogged(frameSize)) return true;
+    __debugOutput(F("Slow consumer, closing connection\n"));
+    _close(TRY_AGAIN_LATER, true);
+    return false;
+  }
+  return true;
+}
+void WebSocket::_conflate(uint8_t channel, const DataType dataType,
+  const char *message, uint16_t length) {
+  if (!m_conflated) {
+    __statsUpdate(++m_stats.droppedMessages);
+    return;
+  }
 
-  if (usingTempBuffer) SAFE_DELETE_ARRAY(payload);
+  for (uint16_t offset = 0; offset < m_conflatedSize;) {
+    const auto entry = m_conflated + offset;
+    const uint16_t entrySize = kEntryHeaderSize + (entry[2] << 8 | entry[3]);
+    if (entry[0] == channel) {
+      __statsUpdate(++m_stats.droppedMessages);
+      m_conflatedSize -= entrySize;
+      memmove(entry, entry + entrySize, m_conflatedSize - offset);
+      break;
+    }
+    offset += entrySize;
+  }
+
+  if (m_conflatedSize + kEntryHeaderSize + length > kConflationBufferSize) {
+    __statsUpdate(++m_stats.droppedMessages);
+    return;
+  }
+  auto entry = m_conflated + m_conflatedSize;
+  entry[0] = channel;
+  entry[1] = static_cast<uint8_t>(dataType);
+  entry[2] = length >> 8;
+  entry[3] = length & 0xFF;
+  memcpy(entry + kEntryHeaderSize, message, length);
+  m_conflatedSize += kEntryHeaderSize + length;
 }
+void WebSocket::_flushConflated() {
+  if (m_conflatedSize == 0 || m_readyState != ReadyState::OPEN) return;
+
+  uint16_t offset{0};
+  while (offset < m_conflatedSize) {
+    const auto entry = m_conflated + offset;
+    const uint16_t length = entry[2] << 8 | entry[3];
+    uint8_t header[kMaxFrameHeaderSize]{};
+    const auto headerSize = _encodeHeader(
+      static_cast<DataType>(entry[1]) == DataType::TEXT ? TEXT_FRAME
+                                                        : BINARY_FRAME,
+      true, false, length, header);
+    if (_isBacklogged(headerSize + length)) break;
+
+    _sendEncoded(header, headerSize,
+      reinterpret_cast<const char *>(entry) + kEntryHeaderSize, length);
+    offset += kEntryHeaderSize + length;
+  }
+  m_conflatedSize -= offset;
+  memmove(m_conflated, m_conflated + offset, m_conflatedSize);
+}
+
 bool WebSocket::_readHeader(header_t &header) {
   char temp[2]{};
   if (!_read(temp, 2)) return false;
@@ -367,7 +1041,7 @@ bool WebSocket::_readHeader(header_t &header) {
     __debugOutput(F("RSV1 = %d, RSV2 = %d, RSV3 = %d\n"), header.rsv1,
       header.rsv2, header.rsv3);
 
-    close(PROTOCOL_ERROR, true);
+    _close(PROTOCOL_ERROR, true);
     return false;
   }
 
@@ -378,7 +1052,7 @@ bool WebSocket::_readHeader(header_t &header) {
     if (!header.fin) {
       __debugOutput(F("Control frames must not be fragmented!\n"));
 
-      close(PROTOCOL_ERROR, true);
+      _close(PROTOCOL_ERROR, true);
       return false;
     }
 
@@ -386,7 +1060,7 @@ bool WebSocket::_readHeader(header_t &header) {
       __debugOutput(
         F("Control frames max length = 125, here = %u\n"), header.length);
 
-      close(PROTOCOL_ERROR, true);
+      _close(PROTOCOL_ERROR, true);
       return false;
     }
   }
@@ -401,20 +1075,22 @@ bool WebSocket::_readHeader(header_t &header) {
   } else if (header.length == 127) {
     __debugOutput(F("Unsupported frame size!\n"));
 
-    close(MESSAGE_TOO_BIG, true);
+    _close(MESSAGE_TOO_BIG, true);
     return false;
   }
 
   if (header.length > kBufferMaxSize) {
     __debugOutput(F("Unsupported frame size = %u\n"), header.length);
 
-    close(MESSAGE_TOO_BIG, true);
+    _close(MESSAGE_TOO_BIG, true);
     return false;
   }
 
   if (header.mask)
     if (!_read(header.maskingKey, 4)) return false;
 
+  __traceEvent(FRAME_RX, header.opcode, header.length);
+
 #ifdef _DUMP_HEADER
   printf(F("RX FRAME : OPCODE=%u, FIN=%s, RSV=%d, PAYLOAD-LEN=%u, MASK="),
     header.opcode, header.fin ? "True" : "False", header.rsv1, header.length);
@@ -427,17 +1103,36 @@ bool WebSocket::_readHeader(header_t &header) {
 
   return true;
 }
-bool WebSocket::_readData(
-  const header_t &header, char *payload, size_t offset) {
-  int32_t bite{-1};
+bool WebSocket::_readData(const header_t &header, char *payload,
+  size_t offset, utf8_state_t *utf8) {
+  static constexpr uint8_t kNoMask[4]{};
+  const auto key = header.mask
+                     ? reinterpret_cast<const uint8_t *>(header.maskingKey)
+                     : kNoMask;
+  uint8_t keyOffset{0};
+
+  const auto cipher =
+    isControlFrame(header.opcode) ? nullptr : m_inboundCipher;
+
+  auto chunk = reinterpret_cast<uint8_t *>(payload + offset);
+  for (int32_t n{0}, remaining = header.length; remaining > 0;
+       chunk += n, remaining -= n) {
+    // Data is placed where it belongs straight away, following stages run
+    // over the chunk in place: unmask -> decrypt -> validate (unmasking and
+    // validation share a loop when there is nothing in between)
+    if ((n = _readSome(reinterpret_cast<char *>(chunk), remaining)) == -1)
+      return false;
 
-  if (header.mask) {
-    for (uint32_t i = 0; i < header.length; ++i) {
-      if ((bite = _read()) == -1) return false;
-      payload[offset + i] = bite ^ header.maskingKey[i % 4];
+    bool valid{true};
+    if (cipher) {
+      if (header.mask) unmaskChunk(chunk, n, key, keyOffset, nullptr);
+      cipher->decrypt(chunk, chunk, n);
+      if (utf8) valid = utf8->feed(chunk, n);
+    } else if (header.mask || utf8) {
+      valid = unmaskChunk(chunk, n, key, keyOffset, utf8);
     }
-  } else {
-    if (!_read(payload, header.length, offset)) {
+    if (!valid) {
+      _close(INVALID_FRAME_PAYLOAD_DATA, true);
       return false;
     }
   }
@@ -456,42 +1151,34 @@ void WebSocket::_clearDataBuffer() {
 }
 
 void WebSocket::_handleContinuationFrame(const header_t &header) {
-  if (m_tbcOpcode == -1) return close(PROTOCOL_ERROR, true);
+  if (m_tbcOpcode == -1) return _close(PROTOCOL_ERROR, true);
 
   if (header.fin) {
     const auto totalLength = m_currentOffset + header.length;
     const auto dataType =
       m_tbcOpcode == Opcode::TEXT_FRAME ? DataType::TEXT : DataType::BINARY;
-    if (dataType == DataType::TEXT) {
-      if (!isValidUTF8(
-            reinterpret_cast<const byte *>(m_dataBuffer), totalLength))
-        return close(INVALID_FRAME_PAYLOAD_DATA, true);
-    }
+    // Payload has been validated as it arrived, only the end is left
+    if (dataType == DataType::TEXT && !m_utf8.isComplete())
+      return _close(INVALID_FRAME_PAYLOAD_DATA, true);
 
-    if (_onMessage) {
-      _onMessage(*this, dataType, m_dataBuffer, totalLength);
-    }
+    __statsUpdate(++m_stats.fragmentedMessages);
+    _deliverMessage(m_tbcOpcode, totalLength);
     _clearDataBuffer();
   } else {
     m_currentOffset += header.length;
   }
 }
 void WebSocket::_handleDataFrame(const header_t &header) {
-  if (m_currentOffset > 0) return close(PROTOCOL_ERROR, true);
+  if (m_currentOffset > 0) return _close(PROTOCOL_ERROR, true);
 
   if (header.fin) {
     const auto dataType =
       header.opcode == Opcode::TEXT_FRAME ? DataType::TEXT : DataType::BINARY;
 
-    if (dataType == DataType::TEXT) {
-      if (!isValidUTF8(
-            reinterpret_cast<const byte *>(m_dataBuffer), header.length))
-        return close(INVALID_FRAME_PAYLOAD_DATA, true);
-    }
+    if (dataType == DataType::TEXT && !m_utf8.isComplete())
+      return _close(INVALID_FRAME_PAYLOAD_DATA, true);
 
-    if (_onMessage) {
-      _onMessage(*this, dataType, m_dataBuffer, header.length);
-    }
+    _deliverMessage(header.opcode, header.length);
     _clearDataBuffer();
   } else {
     m_currentOffset += header.length;
@@ -507,19 +1194,43 @@ void WebSocket::_handleCloseFrame(const header_t &header, const char *payload) {
     for (byte i = 0; i < 2; ++i)
       code = (code << 8) + (payload[i] & 0xFF);
 
-    if (!isCloseCodeValid(code)) return close(PROTOCOL_ERROR, true);
+    if (!isCloseCodeValid(code)) return _close(PROTOCOL_ERROR, true);
 
     reasonLength = header.length - 2;
     reason = &payload[2];
     if (!isValidUTF8(reinterpret_cast<const byte *>(reason), reasonLength))
-      return close(PROTOCOL_ERROR, true);
+      return _close(PROTOCOL_ERROR, true);
   }
 
   __debugOutput(F("Received close frame: code = %u, reason = %s\n"), code,
     header.length ? reason : " ");
 
-  if (m_readyState == ReadyState::OPEN)
-    close(static_cast<CloseCode>(code), true, reason, reasonLength);
+  if (m_readyState == ReadyState::OPEN) {
+    _close(static_cast<CloseCode>(code), true, reason, reasonLength);
+  } else if (m_readyState == ReadyState::CLOSING) {
+    // Endpoint answered our close frame, the closing handshake is complete
+    _terminate();
+    if (_onClose) {
+      __statsTimeCallback(m_stats,
+        _onClose(*this, static_cast<CloseCode>(code), reason, reasonLength));
+    }
+  }
+}
+void WebSocket::_checkCloseTimeout() {
+  if (m_deferredClose) {
+    const auto code = static_cast<CloseCode>(m_deferredClose);
+    m_deferredClose = 0;
+    return _close(code, true);
+  }
+  if (m_readyState != ReadyState::CLOSING) return;
+  if (m_client.connected() && millis() - m_closingStart < kCloseTimeout)
+    return;
+
+  __debugOutput(F("Closing handshake timed out\n"));
+  _terminate();
+  if (_onClose) {
+    __statsTimeCallback(m_stats, _onClose(*this, ABNORMAL_CLOSURE, nullptr, 0));
+  }
 }
 
 } // namespace net
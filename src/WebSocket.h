@@ -2,10 +2,20 @@
 
 /** @file */
 
+#include "function.h"
+#include "stats.h"
+#include "trace.h"
 #include "utility.h"
 
+class Cipher;
+
 namespace net {
 
+/** @cond */
+/// Frame header without masking key (payload length <= 0xFFFF).
+constexpr uint8_t kMaxFrameHeaderSize{4};
+/** @endcond */
+
 /**
  * @brief Generates Sec-WebSocket-Accept value.
  * @param[in] key Client 'Sec-Websocket-Key' to encode
@@ -27,8 +37,10 @@ enum class WebSocketError {
   //
 
   BAD_REQUEST = 400,
+  UNAUTHORIZED = 401,
   REQUEST_TIMEOUT = 408,
   UPGRADE_REQUIRED = 426,
+  TOO_MANY_REQUESTS = 429,
 
   //
   // Server errors:
@@ -39,6 +51,82 @@ enum class WebSocketError {
   SERVICE_UNAVAILABLE = 503
 };
 
+/** @cond */
+/**
+ * @brief Incremental UTF-8 validation, state carries across chunks (and
+ * fragments) of a message.
+ */
+struct utf8_state_t {
+  /// @return false on malformed sequence.
+  bool feed(uint8_t c);
+  /// @return false on malformed sequence.
+  bool feed(const uint8_t *data, size_t length);
+  /// @return true if no sequence is left incomplete.
+  bool isComplete() const { return pending == 0; }
+
+  /// Continuation bytes still expected.
+  uint8_t pending{0};
+  /// Range of the next continuation byte.
+  uint8_t lower{0x80}, upper{0xBF};
+};
+
+/**
+ * @brief Rate limiter, refilled continuously, holds up to one second worth
+ * of tokens.
+ */
+struct token_bucket_t {
+  /// @brief Sets rate (tokens per second, 0 = unlimited) and fills bucket.
+  void reset(uint32_t rate);
+  /// @return false if there aren't enough tokens (none are taken then).
+  bool take(uint32_t amount);
+
+  uint32_t rate{0};
+  uint32_t tokens{0};
+  /// Time of the last refill (in milliseconds).
+  uint32_t lastRefill{0};
+};
+
+#ifdef _STATIC_MEMORY
+/**
+ * @brief Buffers for messages held back by OverflowPolicy::CONFLATE, shared
+ * by connections of a WebSocketServer.
+ */
+struct conflation_pool_t {
+  /// @return Unused buffer (of kConflationBufferSize), nullptr if none left.
+  uint8_t *acquire();
+  void release(uint8_t *buffer);
+
+  uint8_t buffers[kConflationPoolSize][kConflationBufferSize];
+  bool used[kConflationPoolSize]{};
+};
+#endif
+
+#ifdef _DISPATCH_THREAD
+class WebSocket;
+/**
+ * @brief Received message (I/O to dispatch thread) or send request (dispatch
+ * to I/O thread).
+ */
+struct dispatch_entry_t {
+  /// Endpoint, nullptr for broadcast/publish request.
+  WebSocket *ws;
+  uint8_t opcode;
+  /// Topic of publish request (kBroadcastChannel for broadcast), or 1 if
+  /// close request is instant.
+  uint8_t arg;
+  uint16_t length;
+  char data[kBufferMaxSize];
+};
+using DispatchQueue = SpscQueue<dispatch_entry_t, kDispatchQueueSize>;
+#endif
+#if defined(_SHARDING) || defined(_THREAD_SAFE_SEND)
+struct shared_message_t;
+#endif
+#ifdef _THREAD_SAFE_SEND
+using PostQueue = MpscQueue<shared_message_t *, kPostQueueSize>;
+#endif
+/** @endcond */
+
 /**
  * @class WebSocket
  */
@@ -54,6 +142,26 @@ public:
   enum class ReadyState : int8_t { CONNECTING = 0, OPEN, CLOSING, CLOSED };
   /** Frame data types. */
   enum class DataType : int8_t { TEXT, BINARY };
+  /** Part of a message, see send(const DataType, const Slice[], uint8_t). */
+  struct Slice {
+    const char *data;
+    uint16_t length;
+  };
+  /**
+   * Handling of broadcast/published messages when the endpoint can't keep up
+   * (outbound backlog over threshold).
+   */
+  enum class OverflowPolicy : int8_t {
+    /// Messages are written anyway (queued or written in a blocking way).
+    NONE,
+    /// Messages are dropped until the backlog drains.
+    DROP_NEWEST,
+    /// Only the latest message of each channel (topic) is held back and sent
+    /// when the backlog drains.
+    CONFLATE,
+    /// The connection is closed with TRY_AGAIN_LATER.
+    DISCONNECT
+  };
 
   /** Frame opcodes. */
   enum Opcode {
@@ -162,6 +270,28 @@ public:
     // 4000-4999 : Available for use by applications.
   };
 
+  /** Encoded header of a single-frame message (see frameHeader()). */
+  struct FrameHeader {
+    uint8_t bytes[kMaxFrameHeaderSize];
+    uint8_t size;
+    uint16_t length;
+  };
+  /**
+   * @return Header of a message with given length, evaluated at compile time
+   * for constant arguments.
+   * @code{.cpp}
+   * constexpr auto kTelemetryHeader =
+   *   WebSocket::frameHeader(WebSocket::DataType::BINARY, sizeof(Telemetry));
+   *
+   * ws.send(kTelemetryHeader, reinterpret_cast<const char *>(&telemetry));
+   * @endcode
+   */
+  static constexpr FrameHeader frameHeader(
+    const DataType dataType, uint16_t length) {
+    return _makeHeader(dataType == DataType::TEXT ? TEXT_FRAME : BINARY_FRAME,
+      true, false, length);
+  }
+
   /**
    * @param ws Closing endpoint.
    * @param code Close event code.
@@ -169,8 +299,8 @@ public:
    * NULL-terminated. Might be empty.
    * @param length The number of characters in the reason c-string.
    */
-  using onCloseCallback = void (*)(
-    WebSocket &ws, const CloseCode code, const char *reason, uint16_t length);
+  using onCloseCallback = Function<void(
+    WebSocket &ws, const CloseCode code, const char *reason, uint16_t length)>;
 
   /**
    * @param ws Source of a message.
@@ -178,16 +308,16 @@ public:
    * @param message Non NULL-terminated.
    * @param length Number of data bytes.
    */
-  using onMessageCallback = void (*)(WebSocket &ws, const DataType dataType,
-    const char *message, uint16_t length);
+  using onMessageCallback = Function<void(WebSocket &ws,
+    const DataType dataType, const char *message, uint16_t length)>;
 
   /**
    * @param ws Source of a message.
    * @param message Non NULL-terminated.
    * @param length Number of data bytes.
    */
-  using onPingCallback = void (*)(
-    WebSocket &ws, const char *message, uint16_t length);
+  using onPingCallback =
+    Function<void(WebSocket &ws, const char *message, uint16_t length)>;
 
 public:
   WebSocket(const WebSocket &) = delete;
@@ -197,7 +327,8 @@ public:
 
   /**
    * @brief Sends a close event.
-   * @param instant Determines if it should be closed immediately.
+   * @param instant Determines if it should be closed immediately, otherwise
+   * listen() waits (up to kCloseTimeout) for endpoint's close frame.
    * @param reason An additional message (not required), doesn't have to be
    * NULL-terminated. Max length = 123 characters.
    * @param length The number of characters in the reason c-string.
@@ -219,11 +350,33 @@ public:
   IPAddress getRemoteIP() const;
   const char *getProtocol() const;
 
+#ifdef _COLLECT_STATS
+  /** @return Runtime counters of this connection. */
+  const WebSocketStats &getStats() const;
+#endif
+
   /**
    * @brief Sends a message frame.
    * @param message Doesn't have to be NULL-terminated.
    */
   void send(const DataType, const char *message, uint16_t length);
+  /**
+   * @brief Sends parts (in given order) as a single message, without copying
+   * them into one buffer first.
+   * @remark Total length is limited to 65535 bytes.
+   * @code{.cpp}
+   * const WebSocket::Slice parts[]{
+   *   {header, sizeof(header)}, {readings, length}, {trailer, 2}};
+   * ws.send(WebSocket::DataType::BINARY, parts, 3);
+   * @endcode
+   */
+  void send(const DataType, const Slice parts[], uint8_t count);
+  /**
+   * @brief Sends a message with prebuilt header (see frameHeader()), always as
+   * a single frame.
+   * @param message Exactly header.length bytes.
+   */
+  void send(const FrameHeader &header, const char *message);
   /**
    * @brief Sends a ping message.
    * @param payload An additional message, doesn't have to be NULL-terminated.
@@ -232,6 +385,30 @@ public:
    */
   void ping(const char *payload = nullptr, uint16_t length = 0);
 
+#ifdef _THREAD_SAFE_SEND
+  /**
+   * @brief Thread-safe send(): copies the message into a lock-free queue,
+   * listen() sends it on its own thread (or drops it if the connection isn't
+   * open by then).
+   * @code{.cpp}
+   * // Sensor task
+   * if (!client.post(WebSocket::DataType::BINARY, reading, sizeof(reading)))
+   *   ++skipped; // Queue is full
+   * @endcode
+   * @return false if the queue is full (kPostQueueSize messages).
+   * @remark The endpoint must outlive the call, which holds for a
+   * WebSocketClient. WebSocketServer::listen() deletes its endpoints at any
+   * time, use WebSocketServer::postTo() with getId() for those.
+   */
+  bool post(const DataType, const char *message, uint16_t length);
+  /**
+   * @return Id of server endpoint for WebSocketServer::postTo() (0 for client
+   * endpoint). Ids of closed connections aren't reused before 65535 other
+   * connections have taken the same slot.
+   */
+  uint32_t getId() const;
+#endif
+
   /**
    * @brief Sets the close event handler.
    * @code{.cpp}
@@ -250,11 +427,104 @@ public:
    *   // handle data frame ...
    * });
    * @endcode
+   * @remark With _DISPATCH_THREAD handlers of server endpoints run on the
+   * dispatch thread (see WebSocketServer::dispatch()).
    */
   void onMessage(const onMessageCallback &);
 
+  /**
+   * @brief Sets the ping handler (pong is sent automatically).
+   * @remark With kMaxFragmentSize it may also be called from send(), between
+   * fragments of a long message. close() called from there takes effect in
+   * the next listen().
+   */
   void onPing(const onPingCallback &);
 
+  /**
+   * @brief Attaches application state to this endpoint (e.g. in
+   * onConnection), so handlers don't have to look it up.
+   * @code{.cpp}
+   * server.onConnection([](WebSocket &ws) {
+   *   ws.setUserData(&sessions[nextSession++]);
+   *   ws.onMessage([](WebSocket &ws, const WebSocket::DataType dataType,
+   *                  const char *message, uint16_t length) {
+   *     auto session = ws.getUserData<Session>();
+   *     // ...
+   *   });
+   * });
+   * @endcode
+   */
+  void setUserData(void *data);
+  void *getUserData() const;
+  template <typename T> T *getUserData() const {
+    return static_cast<T *>(m_userData);
+  }
+
+  /**
+   * @brief Encrypts payload of data frames (text, binary, continuation) with
+   * a stream-mode cipher, in the same pass that (un)masks it.
+   * @code{.cpp}
+   * wss.onConnection([](WebSocket &ws) {
+   *   // Keys and IVs agreed with the other endpoint
+   *   ws.setCipher(&outbound, &inbound);
+   * });
+   * @endcode
+   * @param outbound Encrypts sent payloads, nullptr disables encryption.
+   * @param inbound Decrypts received payloads (separate key stream),
+   * nullptr disables decryption.
+   * @remark Ciphers must remain valid (and keyed) while the connection is
+   * open. Control frames stay in clear. Both endpoints must use this library,
+   * as text frames carry ciphertext (UTF-8 is validated after decryption).
+   */
+  void setCipher(Cipher *outbound, Cipher *inbound);
+
+  /**
+   * @brief Selects what WebSocketServer::broadcast() and publish() do when
+   * this endpoint doesn't keep up (e.g. in onConnection).
+   * @param threshold Amount of queued outbound data (in bytes), only used on
+   * Linux, other platforms apply the policy when write() would block.
+   * @remark With _STATIC_MEMORY CONFLATE takes a buffer from the server's
+   * pool (kConflationPoolSize), when none is left the endpoint drops newest
+   * messages instead.
+   * @code{.cpp}
+   * wss.onConnection([](WebSocket &ws) {
+   *   // Dashboard only needs current readings
+   *   ws.setOverflowPolicy(WebSocket::OverflowPolicy::CONFLATE);
+   * });
+   * @endcode
+   */
+  void setOverflowPolicy(OverflowPolicy, uint16_t threshold = kMaxBacklog);
+
+  /**
+   * @brief Limits incoming traffic, the connection is closed with
+   * POLICY_VIOLATION as soon as a frame exceeds either limit. Up to one
+   * second worth of traffic may arrive in a burst.
+   * @param messages Frames per second (each final fragment of a message and
+   * each control frame counts), 0 = unlimited.
+   * @param bytes Payload bytes per second, 0 = unlimited. Frames longer than
+   * this are never accepted.
+   * @remark WebSocketServer::setRateLimit() sets it for every new client.
+   */
+  void setRateLimit(uint16_t messages, uint32_t bytes);
+
+#ifdef _CORK
+  /**
+   * @brief Collects subsequent frames in the output buffer until uncork(),
+   * then they are sent in a single write.
+   * @remark Frames that don't fit into kCorkBufferSize bytes force an early
+   * flush.
+   */
+  void cork();
+  /** @brief Sends collected frames. */
+  void uncork();
+  /**
+   * @brief Keeps this endpoint corked, collected frames are sent at the end
+   * of each listen() call (so everything sent during one loop iteration
+   * usually ends up in one TCP segment).
+   */
+  void setAutoCork(bool enabled);
+#endif
+
 protected:
   /** @remark Reserved for WebSocketClient. */
   WebSocket() = default;
@@ -262,26 +532,167 @@ protected:
   WebSocket(const NetClient &, const char *protocol);
 
   /** @cond */
+  /** @brief close() issued by the library itself (protocol errors etc.). */
+  void _close(const CloseCode, bool instant, const char *reason = nullptr,
+    uint16_t length = 0);
+  /** @brief terminate() issued by the library itself. */
+  void _terminate();
+
   int32_t _read();
   bool _read(char *buffer, size_t size, size_t offset = 0);
+  /**
+   * @brief Waits for data (up to kTimeoutInterval) and reads what is
+   * available, at most given size.
+   * @return Number of bytes read or -1 on timeout.
+   */
+  int32_t _readSome(char *buffer, size_t size);
+
+  static constexpr FrameHeader _makeHeader(
+    uint8_t opcode, bool fin, bool mask, uint16_t length) {
+    // Single return statement (C++11 constexpr)
+    return length <= 125
+             ? FrameHeader{{static_cast<uint8_t>(opcode | (fin ? 0x80 : 0)),
+                             static_cast<uint8_t>((mask ? 0x80 : 0) | length)},
+                 2, length}
+             : FrameHeader{{static_cast<uint8_t>(opcode | (fin ? 0x80 : 0)),
+                             static_cast<uint8_t>((mask ? 0x80 : 0) | 126),
+                             static_cast<uint8_t>(length >> 8),
+                             static_cast<uint8_t>(length & 0xFF)},
+                 4, length};
+  }
+  /**
+   * @param[out] header Array of kMaxFrameHeaderSize elements.
+   * @return Size of encoded header (without masking key).
+   */
+  static uint8_t _encodeHeader(
+    uint8_t opcode, bool fin, bool mask, uint16_t length, uint8_t header[]);
 
   void _send(
     uint8_t opcode, bool fin, bool mask, const char *data, uint16_t length);
+  /**
+   * @brief Sends a frame with payload taken from concatenated parts, starting
+   * at offset.
+   */
+  void _send(uint8_t opcode, bool fin, bool mask, const Slice parts[],
+    uint8_t count, uint16_t offset, uint16_t length);
+  /** @brief Sends a frame with encoded header (masked if its bit is set). */
+  void _sendFrame(const uint8_t header[], uint8_t headerSize,
+    const Slice parts[], uint8_t count, uint16_t offset, uint16_t length);
+  /** @brief Sends a frame with already encoded header (unmasked). */
+  void _sendEncoded(const uint8_t header[], uint8_t headerSize,
+    const char *data, uint16_t length);
+  void _onFrameSent(
+    uint8_t opcode, const char *data, uint16_t length, uint16_t bytesWritten);
+  /** @brief Writes to NetClient (or the cork buffer). */
+  size_t _write(const void *data, size_t size);
+  /**
+   * @brief Writes payload through send pipeline (encrypt, mask), chunk by
+   * chunk.
+   * @param maskingKey nullptr if unmasked.
+   * @param position Position in frame payload (continues masking key).
+   */
+  size_t _writePayload(const char *data, uint16_t size, bool encrypt,
+    const char maskingKey[], uint16_t position);
+#ifdef _CORK
+  bool _isCorked() const;
+  /**
+   * @brief Makes room for a frame of given size (header included), a frame
+   * that doesn't fit into the cork buffer at all bypasses it.
+   */
+  void _beginFrame(size_t size);
+  /** @brief Sends collected frames (if any). */
+  void _flushOutput();
+#endif
 
   void _readFrame();
+  /**
+   * @brief Handles control frames that are waiting in the input (between
+   * fragments of an outbound message), only the latest ping is answered.
+   * @remark Connection isn't closed from here (see m_deferredClose).
+   */
+  void _handleControlFrames();
+  /** @brief Sends pong (ahead of corked data frames). */
+  void _sendPong(const char *payload, uint16_t length);
+  /**
+   * @brief Passes complete message (in data buffer) to onMessage callback, or
+   * to the dispatch thread.
+   */
+  void _deliverMessage(uint8_t opcode, uint16_t length);
+#ifdef _DISPATCH_THREAD
+  /// @return true if called from a message handler on the dispatch thread.
+  static bool _isDispatching();
+  /** @brief Runs message handler (on the dispatch thread). */
+  void _dispatch(const dispatch_entry_t &);
+  /**
+   * @brief Copies send request into the queue, waits while it's full.
+   * @param ws Counted as pending (nullptr for broadcast/publish).
+   * @remark Requests longer than kBufferMaxSize are dropped.
+   */
+  static void _enqueue(DispatchQueue &, WebSocket *ws, uint8_t opcode,
+    uint8_t arg, const Slice parts[], uint8_t count);
+#endif
+#ifdef _THREAD_SAFE_SEND
+  /**
+   * @brief Copies message into the queue (safe from any thread).
+   * @param recipient Id of server endpoint, 0 for all of the channel.
+   * @return false if the queue is full.
+   */
+  static bool _post(PostQueue &, uint8_t channel, const DataType,
+    const char *message, uint16_t length, uint32_t recipient = 0);
+  /** @brief Sends posted messages (on the thread of listen()). */
+  void _flushPosted();
+#endif
   bool _readHeader(header_t &);
-  bool _readData(const header_t &, char *payload, size_t offset = 0);
+
+  /// @return true if a frame of given size would exceed backlog threshold.
+  bool _isBacklogged(uint16_t frameSize) const;
+  /**
+   * @brief Applies overflow policy to a broadcast/published message.
+   * @return true if the message should be sent now.
+   */
+  bool _admitMessage(uint8_t channel, const DataType, const char *message,
+    uint16_t length, uint16_t frameSize);
+  /// @brief Holds back message, replacing the previous one of the channel.
+  void _conflate(
+    uint8_t channel, const DataType, const char *message, uint16_t length);
+  /// @brief Sends held back messages (as long as backlog allows).
+  void _flushConflated();
+  /**
+   * @brief Reads payload in chunks, each one runs through receive pipeline
+   * (unmask, validate) while it's still in cache.
+   * @param utf8 Validator of a text message, nullptr skips validation.
+   */
+  bool _readData(const header_t &, char *payload, size_t offset = 0,
+    utf8_state_t *utf8 = nullptr);
 
   void _clearDataBuffer();
 
   void _handleContinuationFrame(const header_t &);
   void _handleDataFrame(const header_t &);
   void _handleCloseFrame(const header_t &, const char *payload);
+  /**
+   * @brief Terminates the connection if endpoint didn't answer close frame in
+   * time (or dropped connection meanwhile), or closes it if m_deferredClose
+   * is set.
+   */
+  void _checkCloseTimeout();
   /** @endcond */
 protected:
-  mutable NetClient m_client;
+  mutable NetTransport m_client;
   ReadyState m_readyState{ReadyState::CLOSED};
+  /// Time when the close frame has been sent (closing handshake started).
+  uint32_t m_closingStart{0};
+  /// Set by close() and terminate(), WebSocketClient doesn't reconnect then.
+  bool m_closedByUser{false};
+  /// Set while send() handles control frames between fragments.
+  bool m_betweenFragments{false};
+  /// Close code recorded meanwhile, applied by the next listen().
+  uint16_t m_deferredClose{0};
+#ifdef _STATIC_MEMORY
+  char m_protocol[kProtocolMaxSize]{};
+#else
   char *m_protocol{nullptr};
+#endif
 
   /** @note A client endpoint must always mask frames. */
   bool m_maskEnabled{true};
@@ -291,17 +702,102 @@ protected:
   /// Indicates an opcode (text/binary) that should be continued by continuation
   /// frame.
   int8_t m_tbcOpcode{-1};
+  /// Validation state of the text message being received.
+  utf8_state_t m_utf8;
+
+#ifdef _CORK
+  uint8_t m_output[kCorkBufferSize];
+  uint16_t m_outputSize{0};
+  /// Size of pong frame waiting at the front of m_output.
+  uint8_t m_pongSize{0};
+  /// Payload length of that pong (it's recorded once written).
+  uint8_t m_pongLength{0};
+  /// Frame being sent is too big for m_output (written directly).
+  bool m_uncorkedFrame{false};
+  bool m_corked{false};
+  bool m_autoCork{false};
+#endif
+
+  void *m_userData{nullptr};
+
+  Cipher *m_outboundCipher{nullptr};
+  Cipher *m_inboundCipher{nullptr};
+
+#ifdef _DISPATCH_THREAD
+  /// Queues of WebSocketServer (nullptr for client endpoint).
+  DispatchQueue *m_inbound{nullptr};
+  DispatchQueue *m_outbound{nullptr};
+  /// Queued entries that refer to this endpoint, it's released when zero.
+  std::atomic<uint16_t> m_pending{0};
+#endif
+#ifdef _THREAD_SAFE_SEND
+  /// Messages of post(), drained by listen().
+  PostQueue m_posted;
+  /// Generation (high 16 bits) and slot it was created in (low 16 bits).
+  uint32_t m_id{0};
+#endif
+
+  token_bucket_t m_messageBucket;
+  token_bucket_t m_byteBucket;
+  /// Remote address of server endpoint (only with per-address limit).
+  uint32_t m_remoteAddress{0};
+
+  OverflowPolicy m_overflowPolicy{OverflowPolicy::NONE};
+  uint16_t m_backlogThreshold{kMaxBacklog};
+  /// Messages held back by OverflowPolicy::CONFLATE.
+  uint8_t *m_conflated{nullptr};
+#ifdef _STATIC_MEMORY
+  /// Source of m_conflated (set by WebSocketServer).
+  conflation_pool_t *m_conflationPool{nullptr};
+#endif
+  uint16_t m_conflatedSize{0};
 
   onCloseCallback _onClose{nullptr};
   onMessageCallback _onMessage{nullptr};
   onPingCallback _onPing{nullptr};
+
+#ifdef _COLLECT_STATS
+  WebSocketStats m_stats;
+#endif
 };
 
 /** @cond */
+/// Conflation channel of WebSocketServer::broadcast() (topics use their id).
+constexpr uint8_t kBroadcastChannel{0xFF};
+
+#if defined(_SHARDING) || defined(_THREAD_SAFE_SEND)
+/**
+ * @brief Message passed between threads, one copy shared by its recipients
+ * (shards), freed by the last one.
+ */
+struct shared_message_t {
+  std::atomic<uint8_t> refs;
+  WebSocket::DataType dataType;
+  /// Topic or kBroadcastChannel.
+  uint8_t channel;
+  uint16_t length;
+#  ifdef _THREAD_SAFE_SEND
+  /// Id of server endpoint, or 0 to send to the channel.
+  uint32_t recipient;
+#  endif
+
+  /// Payload follows the header (single allocation).
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+
+  /// @return Message with a single reference.
+  static shared_message_t *create(uint8_t channel,
+    const WebSocket::DataType, const char *message, uint16_t length);
+  void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+  /** @brief Drops a reference, the last one frees the message. */
+  void release();
+};
+#endif
+
 constexpr uint8_t kValidUpgradeHeader{0x01};
 constexpr uint8_t kValidConnectionHeader{0x02};
 constexpr uint8_t kValidSecKey{0x04};
 constexpr uint8_t kValidVersion{0x08};
+constexpr uint8_t kValidToken{0x10};
 /** @endcond */
 
 } // namespace net
@@ -5,7 +5,8 @@
 
 #define _TRIGGER_ERROR(code)                                                   \
   {                                                                            \
-    terminate();                                                               \
+    __traceEvent(HANDSHAKE_END, 0, static_cast<uint32_t>(code));               \
+    _terminate();                                                              \
     if (_onError) _onError(code);                                              \
   }
 
@@ -32,46 +33,96 @@ void generateSecKey(char output[]) {
 
 bool WebSocketClient::open(const char *host, uint16_t port, const char *path,
   const char *supportedProtocols) {
-  close(GOING_AWAY, true); // Close if already open
+  if (!openAsync(host, port, path, supportedProtocols)) return false;
 
-  if (!m_client.connect(host, port)) {
+  while (m_readyState == ReadyState::CONNECTING) {
+    _readResponse();
+    if (m_readyState == ReadyState::CONNECTING) delay(1);
+  }
+  return m_readyState == ReadyState::OPEN;
+}
+bool WebSocketClient::openAsync(const char *host, uint16_t port,
+  const char *path, const char *supportedProtocols) {
+  if (m_readyState == ReadyState::CONNECTING) _terminate();
+  _close(GOING_AWAY, true); // Close if already open
+  m_closedByUser = false;
+  m_host = host;
+  m_port = port;
+  m_path = path;
+  m_supportedProtocols = supportedProtocols;
+  m_reconnectPending = false;
+  m_handshakeStart = millis();
+  __traceEvent(HANDSHAKE_BEGIN, 0, 0);
+
+  if (!connectAsync(m_client, host, port)) {
     __debugOutput(
       F("Error in connection establishment: net::ERR_CONNECTION_REFUSED\n"));
     _TRIGGER_ERROR(WebSocketError::CONNECTION_REFUSED);
     return false;
   }
+  // The request is sent by listen() once connected
+  m_requestSent = false;
 
-  char secKey[25]{};
-  generateSecKey(secKey);
-  _sendRequest(host, port, path, secKey, supportedProtocols);
+  // Data buffer is unused until the connection is open, it holds the current
+  // response line
+  _clearDataBuffer();
+  m_handshakeFlags = 0;
+  m_handshakeLine = 0;
 
   m_readyState = ReadyState::CONNECTING;
-  if (!_waitForResponse(kTimeoutInterval)) {
-    __debugOutput(
-      F("Error in connection establishment: net::ERR_CONNECTION_TIMED_OUT\n"));
-    _TRIGGER_ERROR(WebSocketError::REQUEST_TIMEOUT);
-    return false;
-  }
-
-  if (!_readResponse(secKey)) return false;
-
-  m_readyState = ReadyState::OPEN;
-  if (_onOpen) _onOpen(*this);
+  __traceEvent(STATE_CHANGE, static_cast<uint8_t>(m_readyState), 0);
   return true;
 }
 void WebSocketClient::terminate() { WebSocket::terminate(); }
 
 void WebSocketClient::listen() {
+#ifdef _THREAD_SAFE_SEND
+  // Messages posted while the connection isn't open are dropped
+  _flushPosted();
+#endif
+  if (m_readyState == ReadyState::CONNECTING) return _readResponse();
+  _checkCloseTimeout();
+
   if (!m_client.connected()) {
     if (m_readyState == ReadyState::OPEN) {
-      terminate();
-      if (_onClose) _onClose(*this, ABNORMAL_CLOSURE, nullptr, 0);
+      _terminate();
+      if (_onClose) {
+        __statsTimeCallback(
+          m_stats, _onClose(*this, ABNORMAL_CLOSURE, nullptr, 0));
+      }
     }
+    // Only lost connections and failed attempts are retried
+    if (m_reconnectMaxDelay && !m_closedByUser) _reconnect();
     return;
   }
 
   if (m_client.available()) _readFrame();
+#ifdef _CORK
+  if (m_autoCork && !m_corked) _flushOutput();
+#endif
+}
+
+void WebSocketClient::enableReconnect(uint32_t minDelay, uint32_t maxDelay) {
+  m_reconnectMinDelay = minDelay ? minDelay : 1;
+  m_reconnectMaxDelay =
+    maxDelay > m_reconnectMinDelay ? maxDelay : m_reconnectMinDelay;
+  m_reconnectDelay = m_reconnectMinDelay;
+  m_reconnectPending = false;
+}
+void WebSocketClient::disableReconnect() {
+  m_reconnectMaxDelay = 0;
+  m_reconnectPending = false;
+}
+
+#ifdef _TLS
+void WebSocketClient::setSecure(bool enabled, const char *caCert) {
+  m_client.setSecure(enabled, caCert);
 }
+void WebSocketClient::setInsecure() { m_client.setInsecure(); }
+bool WebSocketClient::isSessionResumed() const {
+  return m_client.isSessionResumed();
+}
+#endif
 
 void WebSocketClient::onOpen(const onOpenCallback &callback) {
   _onOpen = callback;
@@ -116,15 +167,6 @@ void WebSocketClient::_sendRequest(const char *host, uint16_t port,
 
   m_client.flush();
 }
-bool WebSocketClient::_waitForResponse(uint16_t maxAttempts, uint8_t time) {
-  uint16_t attempts{0};
-  while (!m_client.available() && attempts < maxAttempts) {
-    ++attempts;
-    delay(time);
-  }
-
-  return attempts < maxAttempts;
-}
 
 //
 // Read response (server-side handshake):
@@ -135,127 +177,211 @@ bool WebSocketClient::_waitForResponse(uint16_t maxAttempts, uint8_t time) {
 // [4] Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=
 // [5]
 //
-bool WebSocketClient::_readResponse(const char *secKey) {
-  uint8_t flags{0};
-
-  int32_t bite{-1};
-  byte currentLine{0};
-  byte counter{0};
+bool WebSocketClient::_awaitConnection() {
+  const auto status = checkConnect(m_client);
+  if (status == -1) {
+    __debugOutput(
+      F("Error in connection establishment: net::ERR_CONNECTION_REFUSED\n"));
+    _TRIGGER_ERROR(WebSocketError::CONNECTION_REFUSED);
+    return false;
+  }
+  if (status == 0) {
+    if (millis() - m_handshakeStart > kTimeoutInterval) {
+      __debugOutput(F(
+        "Error in connection establishment: net::ERR_CONNECTION_TIMED_OUT\n"));
+      _TRIGGER_ERROR(WebSocketError::REQUEST_TIMEOUT);
+    }
+    return false;
+  }
 
-  char buffer[128]{};
+  char secKey[25]{};
+  generateSecKey(secKey);
+  _sendRequest(m_host, m_port, m_path, secKey, m_supportedProtocols);
+  encodeSecKey(secKey, m_acceptKey);
+  m_requestSent = true;
+  return true;
+}
+void WebSocketClient::_readResponse() {
+  if (!m_requestSent && !_awaitConnection()) return;
+
+  while (m_client.available()) {
+    const int bite{m_client.read()};
+    if (bite == -1) break;
+    __statsUpdate(++m_stats.bytesIn);
+
+    if (bite != '\n') {
+      // Excess of an overlong line is dropped (none of the relevant headers
+      // is that long)
+      if (m_currentOffset < kBufferMaxSize - 1)
+        m_dataBuffer[m_currentOffset++] = bite;
+      continue;
+    }
 
-  while ((bite = _read()) != -1) {
-    buffer[counter++] = bite;
+    m_dataBuffer[m_currentOffset] = '\0';
+    m_currentOffset = 0;
+    // Anything after the last line belongs to the first frame(s)
+    if (!_handleResponseLine(m_dataBuffer)) return;
+  }
 
-    if (bite == '\n') {
-      uint8_t lineBreakPos = strcspn(buffer, "\r\n");
-      buffer[lineBreakPos] = '\0';
+  if (!m_client.connected()) {
+    __debugOutput(
+      F("Error in connection establishment: net::ERR_CONNECTION_CLOSED\n"));
+    _TRIGGER_ERROR(WebSocketError::CONNECTION_ERROR);
+  } else if (millis() - m_handshakeStart > kTimeoutInterval) {
+    __debugOutput(
+      F("Error in connection establishment: net::ERR_CONNECTION_TIMED_OUT\n"));
+    _TRIGGER_ERROR(WebSocketError::REQUEST_TIMEOUT);
+  }
+}
+bool WebSocketClient::_handleResponseLine(char *buffer) {
+  const uint8_t currentLine{m_handshakeLine++};
+  const auto lineBreakPos = strcspn(buffer, "\r\n");
+  buffer[lineBreakPos] = '\0';
+  __traceEvent(HANDSHAKE_STEP, currentLine, lineBreakPos);
 
 #ifdef _DUMP_HANDSHAKE
-      printf(F("[Line #%u] %s\n"), currentLine, buffer);
+  printf(F("[Line #%u] %s\n"), currentLine, buffer);
 #endif
 
-      if (currentLine == 0) {
-        if (strncmp_P(buffer, (PGM_P)F("HTTP/1.1 101"), 12) != 0) {
-          __debugOutput(F("Error during WebSocket handshake: "
-                          "net::ERR_INVALID_HTTP_RESPONSE\n"));
-          _TRIGGER_ERROR(WebSocketError::BAD_REQUEST);
-          return false;
-        }
-      } else {
-        if (lineBreakPos > 0) {
-          char *rest{buffer};
-          char *value{nullptr};
-
-          char *header{strtok_r(rest, ":", &rest)};
-
-          //
-          // [2] Upgrade header:
-          //
-
-          if (strcasecmp_P(header, (PGM_P)F("Upgrade")) == 0) {
-            value = strtok_r(rest, " ", &rest);
-            if (!value || (strcasecmp_P(value, (PGM_P)F("websocket")) != 0)) {
-              __debugOutput(F("Error during WebSocket handshake: 'Upgrade' "
-                              "header value is not 'websocket': %s\n"),
-                value);
-              _TRIGGER_ERROR(WebSocketError::UPGRADE_REQUIRED);
-              return false;
-            }
-
-            flags |= kValidUpgradeHeader;
-          }
-
-          //
-          // [3] Connection header:
-          //
-
-          else if (strcasecmp_P(header, (PGM_P)F("Connection")) == 0) {
-            value = strtok_r(rest, " ", &rest);
-            if (!value || (strcasecmp_P(value, (PGM_P)F("Upgrade")) != 0)) {
-              __debugOutput(
-                F("Error during WebSocket handshake: 'Connection' header "
-                  "value is not 'Upgrade': %s\n"),
-                value);
-              _TRIGGER_ERROR(WebSocketError::UPGRADE_REQUIRED);
-              return false;
-            }
-
-            flags |= kValidConnectionHeader;
-          }
-
-          //
-          // [4] Sec-WebSocket-Accept header:
-          //
-
-          else if (strcasecmp_P(header, (PGM_P)F("Sec-WebSocket-Accept")) ==
-                   0) {
-            value = strtok_r(rest, " ", &rest);
-
-            char encodedKey[29]{};
-            encodeSecKey(secKey, encodedKey);
-            if (!value || (strcmp(value, encodedKey) != 0)) {
-              __debugOutput(F("Error during WebSocket handshake: Incorrect "
-                              "'Sec-WebSocket-Accept' header value\n"));
-              _TRIGGER_ERROR(WebSocketError::BAD_REQUEST);
-              return false;
-            }
-
-            flags |= kValidSecKey;
-          }
-
-          //
-          // Sec-WebSocket-Protocol (optional):
-          //
-
-          else if (strcasecmp_P(header, (PGM_P)F("Sec-WebSocket-Protocol")) ==
-                   0) {
-            value = strtok_r(rest, " ", &rest);
-            m_protocol = new char[strlen(value) + 1]{};
-            strcpy(m_protocol, value);
-          }
-
-          else {
-            // don't care about other headers ...
-          }
-        }
-
-        //
-        // [5] Empty line (end of response)
-        //
-
-        else
-          break;
-      }
+  if (currentLine == 0) {
+    if (strncmp_P(buffer, (PGM_P)F("HTTP/1.1 101"), 12) != 0) {
+      __debugOutput(F("Error during WebSocket handshake: "
+                      "net::ERR_INVALID_HTTP_RESPONSE\n"));
+      const auto error = strncmp_P(buffer, (PGM_P)F("HTTP/1.1 401"), 12) == 0
+                           ? WebSocketError::UNAUTHORIZED
+                           : WebSocketError::BAD_REQUEST;
+      _TRIGGER_ERROR(error);
+      return false;
+    }
+    return true;
+  }
+
+  //
+  // [5] Empty line (end of response)
+  //
+
+  if (lineBreakPos == 0) {
+    if (!_validateHandshake(m_handshakeFlags)) return false;
+
+    _clearDataBuffer();
+    m_readyState = ReadyState::OPEN;
+    __traceEvent(HANDSHAKE_END, 0, 101);
+    __traceEvent(STATE_CHANGE, static_cast<uint8_t>(m_readyState), 0);
+    __statsUpdate(++m_stats.connections);
+    __statsUpdate(m_stats.handshakeTime += millis() - m_handshakeStart);
+    m_reconnectDelay = m_reconnectMinDelay;
+    if (_onOpen) {
+      __statsTimeCallback(m_stats, _onOpen(*this));
+    }
+    return false;
+  }
+
+  char *rest{buffer};
+  char *value{nullptr};
+
+  char *header{strtok_r(rest, ":", &rest)};
+
+  //
+  // [2] Upgrade header:
+  //
+
+  if (strcasecmp_P(header, (PGM_P)F("Upgrade")) == 0) {
+    value = strtok_r(rest, " ", &rest);
+    if (!value || (strcasecmp_P(value, (PGM_P)F("websocket")) != 0)) {
+      __debugOutput(F("Error during WebSocket handshake: 'Upgrade' "
+                      "header value is not 'websocket': %s\n"),
+        value);
+      _TRIGGER_ERROR(WebSocketError::UPGRADE_REQUIRED);
+      return false;
+    }
 
-      memset(buffer, '\0', sizeof(buffer));
-      counter = 0;
-      ++currentLine;
+    m_handshakeFlags |= kValidUpgradeHeader;
+  }
+
+  //
+  // [3] Connection header:
+  //
+
+  else if (strcasecmp_P(header, (PGM_P)F("Connection")) == 0) {
+    value = strtok_r(rest, " ", &rest);
+    if (!value || (strcasecmp_P(value, (PGM_P)F("Upgrade")) != 0)) {
+      __debugOutput(F("Error during WebSocket handshake: 'Connection' header "
+                      "value is not 'Upgrade': %s\n"),
+        value);
+      _TRIGGER_ERROR(WebSocketError::UPGRADE_REQUIRED);
+      return false;
+    }
+
+    m_handshakeFlags |= kValidConnectionHeader;
+  }
+
+  //
+  // [4] Sec-WebSocket-Accept header:
+  //
+
+  else if (strcasecmp_P(header, (PGM_P)F("Sec-WebSocket-Accept")) == 0) {
+    value = strtok_r(rest, " ", &rest);
+    if (!value || (strcmp(value, m_acceptKey) != 0)) {
+      __debugOutput(F("Error during WebSocket handshake: Incorrect "
+                      "'Sec-WebSocket-Accept' header value\n"));
+      _TRIGGER_ERROR(WebSocketError::BAD_REQUEST);
+      return false;
+    }
+
+    m_handshakeFlags |= kValidSecKey;
+  }
+
+  //
+  // Sec-WebSocket-Protocol (optional):
+  //
+
+  else if (strcasecmp_P(header, (PGM_P)F("Sec-WebSocket-Protocol")) == 0) {
+    value = strtok_r(rest, " ", &rest);
+    if (value) {
+#ifdef _STATIC_MEMORY
+      if (strlen(value) >= kProtocolMaxSize) {
+        __debugOutput(F("Error during WebSocket handshake: "
+                        "'Sec-WebSocket-Protocol' is too long\n"));
+        _TRIGGER_ERROR(WebSocketError::BAD_REQUEST);
+        return false;
+      }
+      strcpy(m_protocol, value);
+#else
+      SAFE_DELETE_ARRAY(m_protocol);
+      m_protocol = new char[strlen(value) + 1]{};
+      strcpy(m_protocol, value);
+#endif
     }
   }
 
-  return _validateHandshake(flags);
+  else {
+    // don't care about other headers ...
+  }
+
+  return true;
+}
+void WebSocketClient::_reconnect() {
+  if (!m_host) return;
+
+  if (!m_reconnectPending) {
+    // "Equal jitter": wait at least half of the delay, the rest is random
+    const uint32_t half{m_reconnectDelay / 2};
+    m_reconnectWait = half + random(m_reconnectDelay - half + 1);
+    m_reconnectStart = millis();
+    m_reconnectPending = true;
+    m_reconnectDelay = m_reconnectDelay < m_reconnectMaxDelay / 2
+                         ? m_reconnectDelay * 2
+                         : m_reconnectMaxDelay;
+    __debugOutput(F("Reconnecting in %lu ms\n"),
+      static_cast<unsigned long>(m_reconnectWait));
+    return;
+  }
+  if (millis() - m_reconnectStart < m_reconnectWait) return;
+
+  // On failure the next listen() schedules another attempt
+  openAsync(m_host, m_port, m_path, m_supportedProtocols);
 }
+
 bool WebSocketClient::_validateHandshake(uint8_t flags) {
   if (!(flags & kValidUpgradeHeader)) {
     __debugOutput(
@@ -11,8 +11,8 @@ namespace net {
  */
 class WebSocketClient final : public WebSocket {
 public:
-  using onOpenCallback = void (*)(WebSocket &);
-  using onErrorCallback = void (*)(const WebSocketError);
+  using onOpenCallback = Function<void(WebSocket &)>;
+  using onErrorCallback = Function<void(const WebSocketError)>;
 
 public:
   WebSocketClient() = default;
@@ -21,14 +21,48 @@ public:
   /**
    * @brief Attempts to connect to a server.
    * @remark Do not use "ws://"
+   * @remark With auto-reconnect enabled, given strings must remain valid for
+   * the lifetime of the client (string literals are fine).
+   * @remark Blocks until the handshake is finished (up to kTimeoutInterval).
    */
   bool open(const char *host, uint16_t port = 3000, const char *path = "/",
     const char *supportedProtocols = nullptr);
+  /**
+   * @brief Starts connecting, listen() completes the connection, sends the
+   * handshake request and consumes the response as it arrives (CONNECTING ->
+   * OPEN), then onOpen or onError is called.
+   * @return false if the connection can't be established (e.g. unknown host).
+   * @remark Given strings must remain valid until the handshake is finished.
+   * @remark Only the name resolution may block on Linux, other network
+   * libraries block in the TCP connect (NetClient::connect()) as well.
+   */
+  bool openAsync(const char *host, uint16_t port = 3000,
+    const char *path = "/", const char *supportedProtocols = nullptr);
   void terminate();
 
   /** @note Call this in the main loop. */
   void listen();
 
+  /**
+   * @brief Enables auto-reconnect, performed by listen() when the connection
+   * is lost or couldn't be established (never blocks while waiting).
+   * @param minDelay Delay before the first attempt (in milliseconds), doubled
+   * after each failed one.
+   * @param maxDelay Upper bound of the delay.
+   * @remark Each delay is randomized (between half and full value), so a fleet
+   * of clients doesn't reconnect to a restarted server at the same time.
+   * @remark Connection closed by close() or terminate() isn't reopened (until
+   * the next open() call).
+   * @code{.cpp}
+   * client.enableReconnect(1000, 30000);
+   * client.openAsync("example.com", 3000); // retried if it fails
+   * @endcode
+   */
+  void enableReconnect(uint32_t minDelay = kReconnectMinDelay,
+    uint32_t maxDelay = kReconnectMaxDelay);
+  /** @brief Cancels pending (and future) reconnect attempts. */
+  void disableReconnect();
+
   /**
    * @brief Sets callback that will be called on a successfull connection.
    * @code{.cpp}
@@ -52,15 +86,65 @@ public:
    */
   void onError(const onErrorCallback &);
 
+#ifdef _TLS
+  /**
+   * @brief Enables TLS (wss://) for subsequent open() calls.
+   * @param caCert PEM encoded certificate(s) used to verify server, nullptr
+   * uses the system trust store (or the certificate bundle on ESP32).
+   * @remark TLS handshake is advanced by listen() (while CONNECTING), resumed
+   * sessions make it considerably shorter.
+   */
+  void setSecure(bool enabled, const char *caCert = nullptr);
+  /**
+   * @brief Enables TLS but accepts any server certificate.
+   * @warning For self-signed test servers only, the connection can be
+   * intercepted.
+   */
+  void setInsecure();
+  /** @return true if TLS session has been resumed (abbreviated handshake). */
+  bool isSessionResumed() const;
+#endif
+
 private:
   /** @cond */
   void _sendRequest(const char *host, uint16_t port, const char *path,
     const char *secKey, const char *supportedProtocols);
-  bool _waitForResponse(uint16_t maxAttempts, uint8_t time = 1);
-  bool _readResponse(const char *secKey);
+  /**
+   * @brief Sends the request once the transport is connected.
+   * @return false until then (or if the connection failed).
+   */
+  bool _awaitConnection();
+  /** @brief Consumes available bytes of the handshake response. */
+  void _readResponse();
+  /** @return false if the handshake is finished (successfully or not). */
+  bool _handleResponseLine(char *buffer);
   bool _validateHandshake(uint8_t flags);
+
+  void _reconnect();
   /** @endcond */
 private:
+  /// Arguments of the last open(), reused by _reconnect().
+  const char *m_host{nullptr};
+  uint16_t m_port{0};
+  const char *m_path{nullptr};
+  const char *m_supportedProtocols{nullptr};
+
+  /// Zero when auto-reconnect is disabled.
+  uint32_t m_reconnectMaxDelay{0};
+  uint32_t m_reconnectMinDelay{0};
+  /// Delay (before jitter) of the next scheduled attempt.
+  uint32_t m_reconnectDelay{0};
+  uint32_t m_reconnectWait{0};
+  uint32_t m_reconnectStart{0};
+  bool m_reconnectPending{false};
+
+  /// Expected Sec-WebSocket-Accept value (while CONNECTING).
+  char m_acceptKey[29]{};
+  bool m_requestSent{false};
+  uint8_t m_handshakeFlags{0};
+  uint8_t m_handshakeLine{0};
+  uint32_t m_handshakeStart{0};
+
   onOpenCallback _onOpen{nullptr};
   onErrorCallback _onError{nullptr};
 };
@@ -1,9 +1,50 @@
 #include "WebSocketServer.h"
+#include "CryptoLegacy/Crypto.h"
+#include "digest.h"
+
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX ||                            \
+  PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP32 ||                              \
+  PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP8266
+#  include <time.h>
+#  define HAVE_TIME
+#endif
 
 // https://developer.mozilla.org/en-US/docs/Web/API/WebSockets_API/Writing_WebSocket_servers
 
 namespace net {
 
+namespace {
+
+/// @return Value of 'token' parameter (terminated in place) or nullptr.
+char *findQueryToken(char *path) {
+  char *param{strchr(path, '?')};
+  while (param) {
+    ++param;
+    if (strncmp_P(param, (PGM_P)F("token="), 6) == 0) {
+      char *value{param + 6};
+      value[strcspn(value, "&")] = '\0';
+      return value;
+    }
+    param = strchr(param, '&');
+  }
+  return nullptr;
+}
+
+uint32_t defaultClock() {
+#ifdef HAVE_TIME
+  return static_cast<uint32_t>(time(nullptr));
+#else
+  return UINT32_MAX; // No clock, every token is expired
+#endif
+}
+
+#ifdef _SHARDING
+/// Shard run by the calling thread (-1 if none).
+thread_local int8_t currentShard{-1};
+#endif
+
+} // namespace
+
 WebSocketServer::WebSocketServer(uint16_t port) : m_server{port} {}
 WebSocketServer::~WebSocketServer() { shutdown(); }
 
@@ -12,43 +53,264 @@ void WebSocketServer::begin(const verifyClientCallback &verifyClient,
   _verifyClient = verifyClient;
   _protocolHandler = protocolHandler;
   m_server.begin();
+#ifdef _SHARDING
+  for (uint8_t i = 0; i < m_shardCount; ++i)
+    m_shards[i].server.begin(m_server);
+#endif
+}
+void WebSocketServer::requireToken(const char *key, size_t keyLength,
+  const char *header, const clockCallback &clock) {
+  m_tokenKey = key;
+  m_tokenKeyLength = keyLength;
+  m_tokenHeader = header;
+  _tokenClock = clock;
+}
+void WebSocketServer::setConnectionLimit(uint8_t count) {
+  m_connectionLimit = count;
+}
+void WebSocketServer::setRateLimit(uint16_t messages, uint32_t bytes) {
+  m_messageRate = messages;
+  m_byteRate = bytes;
 }
 void WebSocketServer::shutdown() {
-  for (auto ws : m_sockets) {
+  for (auto &ws : m_sockets) {
     if (ws) {
       ws->close(WebSocket::CloseCode::GOING_AWAY, true);
-      SAFE_DELETE(ws);
+      __statsUpdate(_closedStats() += ws->m_stats);
+      _releaseWebSocket(ws);
     }
   }
+#ifdef _SHARDING
+  // Shards are stopped, their open connections went to m_closedStats
+  for (auto &shard : m_shards) {
+    // Handed over, but not adopted yet
+    if (auto ws = shard.stolen.exchange(nullptr, std::memory_order_acquire)) {
+      ws->close(WebSocket::CloseCode::GOING_AWAY, true);
+      __statsUpdate(m_closedStats += ws->m_stats);
+      delete ws;
+    }
+    shard.thief.store(-1, std::memory_order_relaxed);
+    shard.victim = -1;
+    shard.reserved = -1;
+    shard.clients.store(0, std::memory_order_relaxed);
+#  ifdef _COLLECT_STATS
+    std::lock_guard<std::mutex> lock{shard.statsLock};
+    shard.stats = shard.closedStats;
+#  endif
+  }
+#endif
 
   // Here I shoud call somethig like m_server.close() but unfortunately
   // EthernetServer does not implement anything like that
   // #TODO server state enum?
 }
 
+#ifdef _SHARDING
+void WebSocketServer::setShards(uint8_t count) {
+  // Each shard needs whole words of topic masks
+  uint16_t limit{kMaxConnections / 32};
+  if (limit > kMaxShards) limit = kMaxShards;
+  if (count > limit) count = limit;
+  m_shardCount = count > 0 ? count : 1;
+}
+#endif
+
 void WebSocketServer::broadcast(
   const WebSocket::DataType dataType, const char *message, uint16_t length) {
-  for (auto ws : m_sockets)
-    if (ws && ws->getReadyState() == WebSocket::ReadyState::OPEN)
-      ws->send(dataType, message, length);
+#ifdef _DISPATCH_THREAD
+  if (WebSocket::_isDispatching()) {
+    const WebSocket::Slice part{message, length};
+    return WebSocket::_enqueue(m_outbound, nullptr,
+      dataType == WebSocket::DataType::TEXT ? WebSocket::TEXT_FRAME
+                                            : WebSocket::BINARY_FRAME,
+      kBroadcastChannel, &part, 1);
+  }
+#endif
+  _publish(kBroadcastChannel, dataType, message, length);
+}
+
+bool WebSocketServer::subscribe(const WebSocket &ws, uint8_t topic) {
+  const auto slot = _findSlot(ws);
+  if (slot == -1 || topic >= kMaxTopics) return false;
+
+  m_topics[topic][slot / 32] |= 1UL << (slot % 32);
+  return true;
+}
+bool WebSocketServer::unsubscribe(const WebSocket &ws, uint8_t topic) {
+  const auto slot = _findSlot(ws);
+  if (slot == -1 || topic >= kMaxTopics) return false;
+
+  m_topics[topic][slot / 32] &= ~(1UL << (slot % 32));
+  return true;
 }
+bool WebSocketServer::isSubscribed(const WebSocket &ws, uint8_t topic) const {
+  const auto slot = _findSlot(ws);
+  if (slot == -1 || topic >= kMaxTopics) return false;
+
+  return m_topics[topic][slot / 32] & (1UL << (slot % 32));
+}
+void WebSocketServer::publish(uint8_t topic,
+  const WebSocket::DataType dataType, const char *message, uint16_t length) {
+  if (topic >= kMaxTopics) return;
+#ifdef _DISPATCH_THREAD
+  if (WebSocket::_isDispatching()) {
+    const WebSocket::Slice part{message, length};
+    return WebSocket::_enqueue(m_outbound, nullptr,
+      dataType == WebSocket::DataType::TEXT ? WebSocket::TEXT_FRAME
+                                            : WebSocket::BINARY_FRAME,
+      topic, &part, 1);
+  }
+#endif
+  _publish(topic, dataType, message, length);
+}
+
+#ifdef _THREAD_SAFE_SEND
+bool WebSocketServer::post(
+  const WebSocket::DataType dataType, const char *message, uint16_t length) {
+  return WebSocket::_post(
+    m_posted, kBroadcastChannel, dataType, message, length);
+}
+bool WebSocketServer::post(uint8_t topic, const WebSocket::DataType dataType,
+  const char *message, uint16_t length) {
+  if (topic >= kMaxTopics) return false;
+  return WebSocket::_post(m_posted, topic, dataType, message, length);
+}
+bool WebSocketServer::postTo(uint32_t id, const WebSocket::DataType dataType,
+  const char *message, uint16_t length) {
+  if (!id) return false;
+  return WebSocket::_post(
+    m_posted, kBroadcastChannel, dataType, message, length, id);
+}
+#endif
 
+#ifdef _SHARDING
+void WebSocketServer::listen(uint8_t shard) {
+  currentShard = shard;
+  uint16_t first, last;
+  _shardSlots(shard, first, last);
+
+  const uint32_t start{micros()};
+#  ifdef _THREAD_SAFE_SEND
+  if (shard == 0) _flushPosted();
+#  endif
+  _drainInbox(shard);
+  const auto frames = _listen(m_shards[shard].server, first, last);
+  if (m_shardCount > 1) _balance(shard, frames, micros() - start);
+#  ifdef _COLLECT_STATS
+  _publishStats(shard, first, last);
+#  endif
+}
+#else
 void WebSocketServer::listen() {
-  _cleanDeadConnections();
+#  ifdef _DISPATCH_THREAD
+  _drainOutbound();
+#  endif
+#  ifdef _THREAD_SAFE_SEND
+  _flushPosted();
+#  endif
+  _listen(m_server, 0, kMaxConnections);
+}
+#endif
+
+#ifdef _DISPATCH_THREAD
+bool WebSocketServer::dispatch() {
+  bool dispatched{false};
+  for (dispatch_entry_t *entry; (entry = m_inbound.front()); m_inbound.pop()) {
+#  ifdef _COLLECT_STATS
+    const uint32_t start{micros()};
+    entry->ws->_dispatch(*entry);
+    m_dispatchTime.fetch_add(micros() - start, std::memory_order_relaxed);
+#  else
+    entry->ws->_dispatch(*entry);
+#  endif
+    // Requests of the handler (if any) are counted already
+    --entry->ws->m_pending;
+    dispatched = true;
+  }
+  return dispatched;
+}
+#endif
+
+uint16_t WebSocketServer::countClients() const {
+  uint16_t count{0};
+#ifdef _SHARDING
+  // Slots of other shards can't be read, each one counts its own
+  for (uint8_t i = 0; i < m_shardCount; ++i)
+    count += m_shards[i].clients.load(std::memory_order_relaxed);
+#else
+  for (auto ws : m_sockets)
+    if (ws && ws->isAlive()) ++count;
+#endif
+  return count;
+}
+
+#ifdef _COLLECT_STATS
+WebSocketStats WebSocketServer::getStats() const {
+  WebSocketStats stats{m_closedStats};
+#  ifdef _SHARDING
+  for (const auto &shard : m_shards) {
+    std::lock_guard<std::mutex> lock{shard.statsLock};
+    stats += shard.stats;
+  }
+#  else
+  for (auto ws : m_sockets)
+    if (ws) stats += ws->m_stats;
+#  endif
+#  ifdef _DISPATCH_THREAD
+  stats.callbackTime += m_dispatchTime.load(std::memory_order_relaxed);
+#  endif
+
+  return stats;
+}
+#endif
+
+void WebSocketServer::onConnection(const onConnectionCallback &callback) {
+  _onConnection = callback;
+}
 
-  auto client = m_server.available();
+uint16_t WebSocketServer::_listen(
+  NetServer &server, uint16_t first, uint16_t last) {
+  _cleanDeadConnections(first, last);
+
+  auto client = server.available();
   if (client) {
-    auto ws = _getWebSocket(client);
+    auto ws = _getWebSocket(client, first, last);
     if (!ws) {
       // A new client
       bool clientRequestFailed = false;
-      for (auto &it : m_sockets) {
+      const uint32_t address{
+        m_connectionLimit ? static_cast<uint32_t>(fetchRemoteIp(client)) : 0};
+      for (auto i = first; i < last; ++i) {
+        auto &it = m_sockets[i];
+#ifdef _SHARDING
+        // Kept for a connection handed over by another shard
+        if (i == m_shards[currentShard].reserved) continue;
+#endif
         if (!it) {
-          char selectedProtocol[32]{};
+          if (m_connectionLimit &&
+              _countConnections(address) >= m_connectionLimit) {
+            __debugOutput(F("Too many connections from one address\n"));
+            _rejectRequest(client, WebSocketError::TOO_MANY_REQUESTS);
+            clientRequestFailed = true;
+            break;
+          }
+          __statsUpdate(const uint32_t handshakeStart{millis()});
+          char selectedProtocol[kProtocolMaxSize]{};
           if (_handleRequest(client, selectedProtocol)) {
-            ws = it = new WebSocket{
-              client, *selectedProtocol ? selectedProtocol : nullptr};
-            if (_onConnection) _onConnection(*ws);
+            ws = it = _createWebSocket(&it - m_sockets, client,
+              *selectedProtocol ? selectedProtocol : nullptr);
+            __statsUpdate(
+              ws->m_stats.handshakeTime = millis() - handshakeStart);
+            ws->m_remoteAddress = address;
+#ifdef _SHARDING
+            m_addresses[i].store(address, std::memory_order_relaxed);
+            m_shards[currentShard].clients.fetch_add(
+              1, std::memory_order_relaxed);
+#endif
+            ws->setRateLimit(m_messageRate, m_byteRate);
+            if (_onConnection) {
+              __statsTimeCallback(ws->m_stats, _onConnection(*ws));
+            }
           } else {
             clientRequestFailed = true;
           }
@@ -61,31 +323,341 @@ void WebSocketServer::listen() {
       }
     }
   }
-  for (auto it : m_sockets) {
-    if (it && it->m_client.connected() && it->m_client.available()) {
+  uint16_t frames{0};
+  for (auto i = first; i < last; ++i) {
+    const auto it = m_sockets[i];
+    if (it && it->m_client.connected() && it->m_client.available() &&
+        !_isDispatchBacklogged()) {
       it->_readFrame();
+      ++frames;
     }
+    if (it) {
+      it->_checkCloseTimeout();
+#ifdef _THREAD_SAFE_SEND
+      it->_flushPosted();
+#endif
+      it->_flushConflated();
+    }
+#ifdef _CORK
+    if (it && it->m_autoCork && !it->m_corked) it->_flushOutput();
+#endif
   }
+  return frames;
 }
+WebSocket *WebSocketServer::_getWebSocket(
+  NetClient &client, uint16_t first, uint16_t last) const {
+  for (auto i = first; i < last; ++i)
+    if (m_sockets[i] && m_sockets[i]->m_client == client) return m_sockets[i];
 
-uint8_t WebSocketServer::countClients() const {
-  uint8_t count{0};
-  for (auto ws : m_sockets)
-    if (ws && ws->isAlive()) ++count;
+  return nullptr;
+}
+uint16_t WebSocketServer::_countConnections(uint32_t address) const {
+  // Unknown (e.g. W5X00 on ESP8266), all clients would share one bucket
+  if (!address) return 0;
 
+  uint16_t count{0};
+#ifdef _SHARDING
+  // Other shards change their slots meanwhile, a limit can live with that
+  for (const auto &it : m_addresses)
+    if (it.load(std::memory_order_relaxed) == address) ++count;
+#else
+  for (const auto ws : m_sockets)
+    if (ws && ws->m_remoteAddress == address) ++count;
+#endif
   return count;
 }
+int32_t WebSocketServer::_findSlot(const WebSocket &ws) const {
+  uint16_t first, last;
+  _ownSlots(first, last);
+  for (auto i = first; i < last; ++i)
+    if (m_sockets[i] == &ws) return i;
 
-void WebSocketServer::onConnection(const onConnectionCallback &callback) {
-  _onConnection = callback;
+  return -1;
 }
+void WebSocketServer::_sendToAll(const uint32_t mask[], uint8_t channel,
+  const WebSocket::DataType dataType, const char *message, uint16_t length) {
+  // Server frames are never masked, so the header is the same for everyone
+  uint8_t header[kMaxFrameHeaderSize]{};
+  const auto headerSize = WebSocket::_encodeHeader(
+    dataType == WebSocket::DataType::TEXT ? WebSocket::TEXT_FRAME
+                                          : WebSocket::BINARY_FRAME,
+    true, false, length, header);
 
-WebSocket *WebSocketServer::_getWebSocket(NetClient &client) const {
-  for (auto ws : m_sockets)
-    if (ws && ws->m_client == client) return ws;
+  uint16_t first, last;
+  _ownSlots(first, last);
+  for (uint16_t i = first / 32; i < (last + 31) / 32; ++i) {
+    uint32_t bits{mask ? mask[i] : 0xFFFFFFFF};
+    for (; bits != 0; bits &= bits - 1) {
+      const auto slot = i * 32 + __builtin_ctzl(bits);
+      if (slot >= last) break;
+
+      const auto ws = m_sockets[slot];
+      if (ws && ws->getReadyState() == WebSocket::ReadyState::OPEN &&
+          ws->_admitMessage(
+            channel, dataType, message, length, headerSize + length))
+        ws->_sendEncoded(header, headerSize, message, length);
+    }
+  }
+}
+void WebSocketServer::_publish(uint8_t channel,
+  const WebSocket::DataType dataType, const char *message, uint16_t length) {
+#ifdef _SHARDING
+  if (currentShard < 0 || m_shardCount > 1) {
+    // One copy for all shards
+    auto shared = shared_message_t::create(channel, dataType, message, length);
+    _publish(*shared);
+    return shared->release();
+  }
+#endif
+  _sendToAll(channel == kBroadcastChannel ? nullptr : m_topics[channel],
+    channel, dataType, message, length);
+}
+#if defined(_SHARDING) || defined(_THREAD_SAFE_SEND)
+void WebSocketServer::_publish(shared_message_t &shared) {
+#  ifdef _SHARDING
+  // No lock: each producer has its own queue
+  const int8_t self{currentShard};
+  for (uint8_t i = 0; i < m_shardCount; ++i) {
+    if (i == self) continue;
 
+    auto &queue = m_shards[i].inbox[self >= 0 ? self : kMaxShards];
+    shared_message_t **entry{nullptr};
+    while (!(entry = queue.back())) {
+      // That shard might be waiting for room in this one's inbox
+      if (self >= 0)
+        _drainInbox(self);
+      else
+        delay(1);
+    }
+    shared.retain();
+    *entry = &shared;
+    queue.push();
+  }
+  if (self < 0) return;
+#  endif
+  _deliver(shared);
+}
+void WebSocketServer::_deliver(shared_message_t &shared) {
+#  ifdef _THREAD_SAFE_SEND
+  if (shared.recipient) {
+    if (auto ws = _findById(shared.recipient))
+      ws->send(shared.dataType, shared.data(), shared.length);
+    return;
+  }
+#  endif
+  _sendToAll(
+    shared.channel == kBroadcastChannel ? nullptr : m_topics[shared.channel],
+    shared.channel, shared.dataType, shared.data(), shared.length);
+}
+#endif
+#ifdef _THREAD_SAFE_SEND
+void WebSocketServer::_flushPosted() {
+  while (auto entry = m_posted.front()) {
+    auto shared = *entry;
+    m_posted.pop();
+    _publish(*shared);
+    shared->release();
+  }
+}
+WebSocket *WebSocketServer::_findById(uint32_t id) const {
+  uint16_t first, last;
+  _ownSlots(first, last);
+  // Connection stays in the slot it was created in, unless a shard stole it
+  const uint16_t slot = id & 0xFFFF;
+  if (slot >= first && slot < last && m_sockets[slot] &&
+      m_sockets[slot]->m_id == id)
+    return m_sockets[slot];
+#  ifdef _SHARDING
+  for (auto i = first; i < last; ++i)
+    if (m_sockets[i] && m_sockets[i]->m_id == id) return m_sockets[i];
+#  endif
   return nullptr;
 }
+#endif
+void WebSocketServer::_ownSlots(uint16_t &first, uint16_t &last) const {
+#ifdef _SHARDING
+  if (currentShard >= 0) return _shardSlots(currentShard, first, last);
+#endif
+  first = 0;
+  last = kMaxConnections;
+}
+#ifdef _SHARDING
+void WebSocketServer::_shardSlots(
+  uint8_t shard, uint16_t &first, uint16_t &last) const {
+  // Whole words of topic masks, the last shard takes the rest
+  const uint16_t size = kMaxConnections / m_shardCount / 32 * 32;
+  first = shard * size;
+  last = shard + 1 == m_shardCount ? kMaxConnections : first + size;
+}
+void WebSocketServer::_drainInbox(uint8_t shard) {
+  for (auto &queue : m_shards[shard].inbox) {
+    while (auto entry = queue.front()) {
+      // Popped first, sending may get here again (e.g. through onClose)
+      auto shared = *entry;
+      queue.pop();
+      _deliver(*shared);
+      shared->release();
+    }
+  }
+}
+void WebSocketServer::_balance(
+  uint8_t shard, uint16_t frames, uint32_t duration) {
+  auto &self = m_shards[shard];
+  self.load.store(duration, std::memory_order_relaxed);
+  uint16_t first, last;
+  _shardSlots(shard, first, last);
+
+  // Hand over a connection that still has data waiting, unless it's the only
+  // one (moving it wouldn't make this shard any less busy)
+  const int8_t thief{self.thief.load(std::memory_order_acquire)};
+  if (thief >= 0) {
+    int32_t candidate{-1};
+    uint16_t backlogged{0};
+    for (auto i = first; i < last; ++i) {
+      const auto ws = m_sockets[i];
+      if (ws && ws->m_readyState == WebSocket::ReadyState::OPEN &&
+          ws->m_client.available()) {
+        ++backlogged;
+        candidate = i;
+      }
+    }
+    if (backlogged > 1) {
+      uint32_t topics{0};
+      for (uint8_t topic = 0; topic < kMaxTopics; ++topic) {
+        auto &word = m_topics[topic][candidate / 32];
+        const auto bit = 1UL << (candidate % 32);
+        if (word & bit) topics |= 1UL << topic;
+        word &= ~bit;
+      }
+      auto &ws = m_sockets[candidate];
+      m_addresses[candidate].store(0, std::memory_order_relaxed);
+      self.clients.fetch_sub(1, std::memory_order_relaxed);
+      self.server.release(_transport(*ws));
+      auto &target = m_shards[thief];
+      target.stolenTopics = topics;
+      target.stolen.store(ws, std::memory_order_release);
+      ws = nullptr;
+    }
+    self.thief.store(-1, std::memory_order_release);
+  }
+
+  // Adopt connection handed over to this shard (into the slot reserved for
+  // it, accepted clients might have taken all others meanwhile)
+  auto ws = self.stolen.load(std::memory_order_acquire);
+  if (ws) {
+    const auto slot = self.reserved;
+    self.server.adopt(_transport(*ws));
+    for (uint8_t topic = 0; topic < kMaxTopics; ++topic)
+      if (self.stolenTopics & (1UL << topic))
+        m_topics[topic][slot / 32] |= 1UL << (slot % 32);
+    m_sockets[slot] = ws;
+    m_addresses[slot].store(ws->m_remoteAddress, std::memory_order_relaxed);
+    self.clients.fetch_add(1, std::memory_order_relaxed);
+    self.stolen.store(nullptr, std::memory_order_relaxed);
+    self.reserved = -1;
+    return;
+  }
+
+  // The previous request has been answered (or refused)
+  if (self.victim >= 0 &&
+      m_shards[self.victim].thief.load(std::memory_order_acquire) != shard) {
+    self.victim = -1;
+    // The answer is stored after the connection, keep the slot if it came
+    if (!self.stolen.load(std::memory_order_acquire)) self.reserved = -1;
+  }
+
+  // Idle shard asks the busiest one for a connection
+  if (frames > 0 || self.victim >= 0 || self.reserved >= 0) return;
+  int32_t freeSlot{-1};
+  for (auto i = first; i < last && freeSlot == -1; ++i)
+    if (!m_sockets[i]) freeSlot = i;
+  if (freeSlot == -1) return;
+  int8_t busiest{-1};
+  uint32_t maxLoad{kStealThreshold - 1};
+  for (uint8_t i = 0; i < m_shardCount; ++i) {
+    const auto load = m_shards[i].load.load(std::memory_order_relaxed);
+    if (i != shard && load > maxLoad) {
+      busiest = i;
+      maxLoad = load;
+    }
+  }
+  int8_t expected{-1};
+  if (busiest >= 0 && m_shards[busiest].thief.compare_exchange_strong(
+                        expected, shard, std::memory_order_acq_rel)) {
+    self.victim = busiest;
+    self.reserved = freeSlot;
+  }
+}
+#  ifdef _COLLECT_STATS
+void WebSocketServer::_publishStats(
+  uint8_t shard, uint16_t first, uint16_t last) {
+  auto &self = m_shards[shard];
+  if (millis() - self.statsTime < kShardStatsInterval) return;
+
+  WebSocketStats stats{self.closedStats};
+  for (auto i = first; i < last; ++i)
+    if (m_sockets[i]) stats += m_sockets[i]->m_stats;
+  // Never waits for getStats(), the next call tries again
+  std::unique_lock<std::mutex> lock{self.statsLock, std::try_to_lock};
+  if (!lock) return;
+  self.stats = stats;
+  self.statsTime = millis();
+}
+#  endif
+NetClient &WebSocketServer::_transport(WebSocket &ws) {
+#  ifdef _TLS
+  return ws.m_client.transport();
+#  else
+  return ws.m_client;
+#  endif
+}
+#endif
+#ifdef _COLLECT_STATS
+WebSocketStats &WebSocketServer::_closedStats() {
+#  ifdef _SHARDING
+  if (currentShard >= 0) return m_shards[currentShard].closedStats;
+#  endif
+  return m_closedStats;
+}
+#endif
+WebSocket *WebSocketServer::_createWebSocket(
+  uint16_t slot, const NetClient &client, const char *protocol) {
+#ifdef _STATIC_MEMORY
+  auto ws = new (m_pool[slot]) WebSocket{client, protocol};
+  ws->m_conflationPool = &m_conflationPool;
+#else
+  (void)slot;
+  auto ws = new WebSocket{client, protocol};
+#endif
+#ifdef _DISPATCH_THREAD
+  ws->m_inbound = &m_inbound;
+  ws->m_outbound = &m_outbound;
+#endif
+#ifdef _THREAD_SAFE_SEND
+  // Generation 0 is skipped, so no id is 0
+  if (++m_generations[slot] == 0) m_generations[slot] = 1;
+  ws->m_id = static_cast<uint32_t>(m_generations[slot]) << 16 | slot;
+#endif
+  return ws;
+}
+void WebSocketServer::_releaseWebSocket(WebSocket *&ws) {
+  const auto slot = &ws - m_sockets;
+  for (auto &mask : m_topics)
+    mask[slot / 32] &= ~(1UL << (slot % 32));
+#ifdef _SHARDING
+  m_addresses[slot].store(0, std::memory_order_relaxed);
+  // shutdown() runs outside of shards, it resets their counts
+  if (currentShard >= 0)
+    m_shards[currentShard].clients.fetch_sub(1, std::memory_order_relaxed);
+#endif
+
+#ifdef _STATIC_MEMORY
+  ws->~WebSocket();
+  ws = nullptr;
+#else
+  SAFE_DELETE(ws);
+#endif
+}
 
 //
 // Read client request:
@@ -100,6 +672,8 @@ WebSocket *WebSocketServer::_getWebSocket(NetClient &client) const {
 //
 bool WebSocketServer::_handleRequest(
   NetClient &client, char selectedProtocol[]) {
+  __traceEvent(HANDSHAKE_BEGIN, 0, 0);
+
 #if NETWORK_CONTROLLER == NETWORK_CONTROLLER_WIFI
   while (!client.available()) {
     delay(10);
@@ -116,7 +690,7 @@ bool WebSocketServer::_handleRequest(
 
   char secKey[32]{}; // Holds client Sec-WebSocket-Key
   uint8_t flags{0};
-  char protocols[32]{};
+  char protocols[kProtocolMaxSize]{};
 
   int32_t bite{-1};
   byte currentLine{0};
@@ -128,6 +702,7 @@ bool WebSocketServer::_handleRequest(
     if (bite == '\n') {
       const auto lineBreakPos = static_cast<uint8_t>(strcspn(buffer, "\r\n"));
       buffer[lineBreakPos] = '\0';
+      __traceEvent(HANDSHAKE_STEP, currentLine, lineBreakPos);
 #ifdef _DUMP_HANDSHAKE
       printf(F("[Line #%u] %s\n"), currentLine, buffer);
 #endif
@@ -139,20 +714,44 @@ bool WebSocketServer::_handleRequest(
       //
 
       if (currentLine == 0) {
-        if (!_isValidGET(rest)) {
+        char *path{nullptr};
+        if (!_isValidGET(rest, path)) {
           _rejectRequest(client, WebSocketError::BAD_REQUEST);
           return false;
         }
+
+        if (m_tokenKey) {
+          const auto token = path ? findQueryToken(path) : nullptr;
+          if (token ? !_isValidToken(token) : !m_tokenHeader) {
+            _rejectRequest(client, WebSocketError::UNAUTHORIZED);
+            return false;
+          }
+          if (token) flags |= kValidToken;
+        }
       } else {
         if (lineBreakPos > 0) {
           auto header = strtok_r(rest, ":", &rest);
           char *value{nullptr};
 
+          //
+          // Token header (optional, see requireToken()):
+          //
+
+          if (m_tokenKey && m_tokenHeader &&
+              strcasecmp(header, m_tokenHeader) == 0) {
+            value = strtok_r(rest, " ", &rest);
+            if (!value || !_isValidToken(value)) {
+              _rejectRequest(client, WebSocketError::UNAUTHORIZED);
+              return false;
+            }
+            flags |= kValidToken;
+          }
+
           //
           // [2] Host header:
           //
 
-          if (strcasecmp_P(header, (PGM_P)F("Host")) == 0) {
+          else if (strcasecmp_P(header, (PGM_P)F("Host")) == 0) {
             // #TODO ... or not
           }
 
@@ -207,10 +806,19 @@ bool WebSocketServer::_handleRequest(
 
           else if (strcasecmp_P(header, (PGM_P)F("Sec-WebSocket-Protocol")) ==
                    0) {
-            for (byte i = 0; rest != nullptr; ++i) {
-              if (*protocols) strcat(protocols, ",");
-              const auto pch = strtok_r(rest, ",", &rest);
-              strcat(protocols, pch + 1); // Skip leading whitespace
+            // NOTE: glibc doesn't set 'rest' to NULL after the last token
+            char *pch{nullptr};
+            while ((pch = strtok_r(rest, ",", &rest))) {
+              if (*pch == ' ') ++pch; // Skip leading whitespace
+              // Only whole names, those that don't fit aren't offered
+              const auto length = strlen(protocols);
+              const auto separator = length ? 1 : 0;
+              if (length + separator + strlen(pch) >= sizeof(protocols)) {
+                __debugOutput(F("Subprotocol ignored: %s\n"), pch);
+                continue;
+              }
+              if (length) strcat(protocols, ",");
+              strcat(protocols, pch);
             }
           }
 
@@ -234,6 +842,11 @@ bool WebSocketServer::_handleRequest(
         //
 
         else {
+          if (m_tokenKey && !(flags & kValidToken)) {
+            _rejectRequest(client, WebSocketError::UNAUTHORIZED);
+            return false;
+          }
+
           const auto errorCode = _validateHandshake(flags, secKey);
           if (errorCode != WebSocketError::NO_ERROR) {
             _rejectRequest(client, errorCode);
@@ -242,9 +855,15 @@ bool WebSocketServer::_handleRequest(
 
           selectedProtocol[0] = '\0';
           if (*protocols) {
-            strcpy(selectedProtocol, _protocolHandler
-                                       ? _protocolHandler(protocols)
-                                       : strtok_r(protocols, ",", &rest));
+            const char *protocol{_protocolHandler
+                                   ? _protocolHandler(protocols)
+                                   : strtok_r(protocols, ",", &rest)};
+            if (protocol && strlen(protocol) >= kProtocolMaxSize) {
+              __debugOutput(F("Subprotocol too long: %s\n"), protocol);
+              _rejectRequest(client, WebSocketError::BAD_REQUEST);
+              return false;
+            }
+            if (protocol) strcpy(selectedProtocol, protocol);
           }
           _acceptRequest(client, secKey, selectedProtocol);
           return true;
@@ -260,10 +879,10 @@ bool WebSocketServer::_handleRequest(
   _rejectRequest(client, WebSocketError::BAD_REQUEST);
   return false;
 }
-bool WebSocketServer::_isValidGET(char *line) {
+bool WebSocketServer::_isValidGET(char *line, char *&path) {
   char *rest{line};
-  for (byte i = 0; rest != nullptr; ++i) {
-    const auto pch = strtok_r(rest, " ", &rest);
+  char *pch{nullptr};
+  for (byte i = 0; (pch = strtok_r(rest, " ", &rest)); ++i) {
     switch (i) {
     case 0: {
       if (strcmp_P(pch, (PGM_P)F("GET")) != 0) {
@@ -272,7 +891,8 @@ bool WebSocketServer::_isValidGET(char *line) {
       break;
     }
     case 1: {
-      break; // path doesn't matter ...
+      path = pch;
+      break;
     }
     case 2: {
       if (strcmp_P(pch, (PGM_P)F("HTTP/1.1")) != 0) {
@@ -287,6 +907,32 @@ bool WebSocketServer::_isValidGET(char *line) {
 
   return true;
 }
+bool WebSocketServer::_isValidToken(const char *token) const {
+  constexpr uint8_t kSignatureLength{40}; // Hex of 20 bytes
+  const char *signature{strchr(token, '.')};
+  if (!signature || signature == token || signature - token > 10 ||
+      strlen(signature + 1) != kSignatureLength)
+    return false;
+
+  uint32_t expiry{0};
+  for (auto p = token; p != signature; ++p) {
+    if (*p < '0' || *p > '9') return false;
+    const uint8_t digit = *p - '0';
+    if (expiry > (UINT32_MAX - digit) / 10) return false;
+    expiry = expiry * 10 + digit;
+  }
+  if (expiry < (_tokenClock ? _tokenClock() : defaultClock())) return false;
+
+  uint8_t hash[20];
+  hmacSha1(m_tokenKey, m_tokenKeyLength, token, signature - token, hash);
+  constexpr char kHexDigits[]{"0123456789abcdef"};
+  char expected[kSignatureLength];
+  for (uint8_t i = 0; i < 20; ++i) {
+    expected[i * 2] = kHexDigits[hash[i] >> 4];
+    expected[i * 2 + 1] = kHexDigits[hash[i] & 0x0F];
+  }
+  return secure_compare(expected, signature + 1, kSignatureLength);
+}
 bool WebSocketServer::_isValidUpgrade(const char *value) {
   return strcasecmp_P(value, (PGM_P)F("websocket")) == 0;
 }
@@ -326,6 +972,7 @@ WebSocketError WebSocketServer::_validateHandshake(
 }
 void WebSocketServer::_rejectRequest(
   NetClient &client, const WebSocketError code) {
+  __traceEvent(HANDSHAKE_END, 0, static_cast<uint32_t>(code));
   switch (code) {
   case WebSocketError::CONNECTION_REFUSED: {
     client.println(F("HTTP/1.1 111 Connection refused"));
@@ -335,10 +982,18 @@ void WebSocketServer::_rejectRequest(
     client.println(F("HTTP/1.1 400 Bad Request"));
     break;
   }
+  case WebSocketError::UNAUTHORIZED: {
+    client.println(F("HTTP/1.1 401 Unauthorized"));
+    break;
+  }
   case WebSocketError::UPGRADE_REQUIRED: {
     client.println(F("HTTP/1.1 426 Upgrade Required"));
     break;
   }
+  case WebSocketError::TOO_MANY_REQUESTS: {
+    client.println(F("HTTP/1.1 429 Too Many Requests"));
+    break;
+  }
   case WebSocketError::SERVICE_UNAVAILABLE: {
     client.println(F("HTTP/1.1 503 Service Unavailable"));
     break;
@@ -363,6 +1018,7 @@ void WebSocketServer::_rejectRequest(
 //
 void WebSocketServer::_acceptRequest(
   NetClient &client, const char *secKey, const char *protocol) {
+  __traceEvent(HANDSHAKE_END, 0, 101);
   client.println(F("HTTP/1.1 101 Switching Protocols"));
   // client.println(F("Server: Arduino"));
   client.println(F("X-Powered-By: mWebSockets"));
@@ -385,13 +1041,60 @@ void WebSocketServer::_acceptRequest(
   client.println();
 }
 
-void WebSocketServer::_cleanDeadConnections() {
-  for (auto &it : m_sockets) {
+void WebSocketServer::_cleanDeadConnections(uint16_t first, uint16_t last) {
+  for (auto i = first; i < last; ++i) {
+    auto &it = m_sockets[i];
+#ifdef _DISPATCH_THREAD
+    // Dispatch thread may still use it
+    if (it && it->m_pending > 0) continue;
+#endif
     if (it && !it->isAlive()) {
-      delete it;
-      it = nullptr;
+      __statsUpdate(_closedStats() += it->m_stats);
+      _releaseWebSocket(it);
     }
   }
 }
+bool WebSocketServer::_isDispatchBacklogged() {
+#ifdef _DISPATCH_THREAD
+  return !m_inbound.back();
+#else
+  return false;
+#endif
+}
+#ifdef _DISPATCH_THREAD
+void WebSocketServer::_drainOutbound() {
+  for (dispatch_entry_t *entry; (entry = m_outbound.front());
+       m_outbound.pop()) {
+    const auto dataType = entry->opcode == WebSocket::TEXT_FRAME
+                            ? WebSocket::DataType::TEXT
+                            : WebSocket::DataType::BINARY;
+    auto ws = entry->ws;
+    if (!ws) {
+      _publish(entry->arg, dataType, entry->data, entry->length);
+      continue;
+    }
+
+    switch (entry->opcode) {
+    case WebSocket::TEXT_FRAME:
+    case WebSocket::BINARY_FRAME: {
+      ws->send(dataType, entry->data, entry->length);
+      break;
+    }
+    case WebSocket::PING_FRAME: {
+      ws->ping(entry->data, entry->length);
+      break;
+    }
+    case WebSocket::CONNECTION_CLOSE_FRAME: {
+      const uint16_t code = (static_cast<uint8_t>(entry->data[0]) << 8) |
+                            static_cast<uint8_t>(entry->data[1]);
+      ws->close(static_cast<WebSocket::CloseCode>(code), entry->arg,
+        entry->data + 2, entry->length - 2);
+      break;
+    }
+    }
+    --ws->m_pending;
+  }
+}
+#endif
 
 } // namespace net
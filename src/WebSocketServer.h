@@ -4,6 +4,9 @@
 
 #include "WebSocket.h"
 #include "utility.h"
+#ifdef _SHARDING
+#  include <mutex>
+#endif
 
 namespace net {
 
@@ -16,11 +19,13 @@ public:
    * @param header c-string, NULL-terminated.
    * @param value c-string, NULL-terminated.
    */
-  using verifyClientCallback = bool (*)(
-    const IPAddress &, const char *header, const char *value);
+  using verifyClientCallback = Function<bool(
+    const IPAddress &, const char *header, const char *value)>;
   /** @param ws Accepted client. */
-  using onConnectionCallback = void (*)(WebSocket &ws);
-  using protocolHandlerCallback = const char *(*)(const char *);
+  using onConnectionCallback = Function<void(WebSocket &ws)>;
+  using protocolHandlerCallback = Function<const char *(const char *)>;
+  /** @return Current Unix time (seconds). */
+  using clockCallback = Function<uint32_t()>;
 
 public:
   /**
@@ -50,18 +55,185 @@ public:
    */
   void begin(const verifyClientCallback &verifyClient = nullptr,
     const protocolHandlerCallback &protocolHandler = nullptr);
-  /** @brief Disconnects all clients. */
+  /**
+   * @brief Disconnects all clients.
+   * @remark With shards, stop their threads first.
+   */
   void shutdown();
 
+#ifdef _SHARDING
+  /**
+   * @brief Spreads connections across given number of shards (call before
+   * begin()). Each shard is an event loop, run by listen(shard) on its own
+   * thread, that owns a disjoint range of connection slots.
+   * @code{.cpp}
+   * server.setShards(4);
+   * server.begin();
+   * for (uint8_t i = 0; i < 4; ++i)
+   *   std::thread{[i] {
+   *     while (true) server.listen(i);
+   *   }}.detach();
+   * @endcode
+   * @remark New clients are accepted by whichever shard polls first (idle
+   * shards take most of them) and an idle shard takes over a backlogged
+   * connection from a busy one (kStealThreshold). Callbacks of a connection
+   * therefore may run on any shard thread, though never concurrently.
+   * broadcast() and publish() may be called from shard threads and from one
+   * other thread. Other methods (e.g. subscribe()) only from the thread of
+   * the shard that owns the client. countClients() and getStats() may be
+   * called from any thread. They sum counters that each shard keeps for its
+   * own clients, so a closed client counts until its shard's next listen(),
+   * and stats lag by up to kShardStatsInterval.
+   */
+  void setShards(uint8_t count);
+#endif
+
+  /**
+   * @brief Requires every client to present a signed token
+   * "<expiry>.<signature>", where expiry is Unix time (decimal) and signature
+   * is lowercase hex of HMAC-SHA1 of the expiry string.
+   * Token is taken from `token` parameter of the request path query string
+   * (`GET /chat?token=...`) or from given header. Request is rejected with
+   * 401 as soon as the token fails, before remaining headers are processed.
+   * @remark Only the query string token is checked before any header. Headers
+   * that precede the token header are processed (and passed to verifyClient)
+   * before the token is known, clients should send it first.
+   * @code{.cpp}
+   * constexpr char kSecret[]{"secret"};
+   * server.requireToken(kSecret, sizeof(kSecret) - 1, "X-Auth-Token");
+   * @endcode
+   * @param key Secret key (must remain valid), nullptr disables tokens.
+   * @param header Name of header carrying the token, nullptr to accept query
+   * string only (then requests without it are rejected at the request line).
+   * @param clock Source of current time, uses time() if not given. Boards
+   * without it must provide one, otherwise every token is treated as expired.
+   */
+  void requireToken(const char *key, size_t keyLength,
+    const char *header = nullptr, const clockCallback &clock = nullptr);
+
+  /**
+   * @brief Limits simultaneous connections from one remote IP address,
+   * further requests are rejected (429) before the handshake, so they don't
+   * take a slot.
+   * @param count Maximum per address, 0 disables the limit.
+   * @remark Clients whose address the network library doesn't report (e.g.
+   * W5X00 on ESP8266) aren't limited.
+   */
+  void setConnectionLimit(uint8_t count);
+  /**
+   * @brief Rate limit applied to every new client (before onConnection), see
+   * WebSocket::setRateLimit().
+   */
+  void setRateLimit(uint16_t messages, uint32_t bytes);
+
   /** @brief Sends message to all connected clients. */
   void broadcast(
     const WebSocket::DataType dataType, const char *message, uint16_t length);
 
+  /**
+   * @brief Adds a client to a topic (room).
+   * @param topic Topic identifier, from 0 to kMaxTopics - 1.
+   * @return false if client doesn't belong to this server or topic is invalid.
+   * @remark Subscriptions are dropped when client disconnects.
+   */
+  bool subscribe(const WebSocket &, uint8_t topic);
+  /** @brief Removes a client from a topic. */
+  bool unsubscribe(const WebSocket &, uint8_t topic);
+  bool isSubscribed(const WebSocket &, uint8_t topic) const;
+  /**
+   * @brief Sends message to all clients subscribed to a topic.
+   * @code{.cpp}
+   * constexpr uint8_t kTemperature{0};
+   * server.onConnection([](WebSocket &ws) {
+   *   server.subscribe(ws, kTemperature);
+   * });
+   * // ...
+   * server.publish(kTemperature, WebSocket::DataType::TEXT, "21.5", 4);
+   * @endcode
+   */
+  void publish(uint8_t topic, const WebSocket::DataType dataType,
+    const char *message, uint16_t length);
+
+#ifdef _THREAD_SAFE_SEND
+  /**
+   * @brief Thread-safe broadcast(): message is copied once into a lock-free
+   * queue, listen() sends it to all clients.
+   * @code{.cpp}
+   * // Any task
+   * server.post(WebSocket::DataType::TEXT, "alarm", 5);
+   * @endcode
+   * @return false if the queue is full (kPostQueueSize messages).
+   * @remark With shards, listen(0) takes messages from the queue. Messages
+   * keep their order within this queue, but not relative to WebSocket::post().
+   */
+  bool post(
+    const WebSocket::DataType dataType, const char *message, uint16_t length);
+  /** @brief Thread-safe publish(), see post(). */
+  bool post(uint8_t topic, const WebSocket::DataType dataType,
+    const char *message, uint16_t length);
+  /**
+   * @brief Thread-safe send() to one client, addressed by WebSocket::getId()
+   * (the task never touches the endpoint, listen() may delete it meanwhile).
+   * @code{.cpp}
+   * server.onConnection([](WebSocket &ws) { sensorClient = ws.getId(); });
+   * // Sensor task
+   * server.postTo(sensorClient, WebSocket::DataType::BINARY, data, size);
+   * @endcode
+   * @return false if the id is 0 or the queue is full. Message for a closed
+   * connection is dropped by listen().
+   * @remark Shares the queue (and order) of post(). With shards, a client
+   * moved to another shard meanwhile may miss the message (or get it twice),
+   * the same as with post().
+   */
+  bool postTo(uint32_t id, const WebSocket::DataType dataType,
+    const char *message, uint16_t length);
+#endif
+
+#ifdef _SHARDING
+  /** @note Call this in a loop of given shard's thread (or main loop). */
+  void listen(uint8_t shard = 0);
+#else
   /** @note Call this in main loop. */
   void listen();
+#endif
+
+#ifdef _DISPATCH_THREAD
+  /**
+   * @brief Runs message handlers of received messages, call this in a loop
+   * of the dispatch thread (or task), while listen() runs on another one.
+   * Handlers may call send(), ping() and close() of given endpoint, and
+   * broadcast()/publish() of this server, these requests are queued and
+   * carried out by the next listen().
+   * @code{.cpp}
+   * // Linux
+   * std::thread dispatcher{[] {
+   *   while (running)
+   *     if (!server.dispatch()) delay(1);
+   * }};
+   * // ESP32, listen() runs in loop() (core 1)
+   * xTaskCreatePinnedToCore([](void *) {
+   *   for (;;)
+   *     if (!server.dispatch()) vTaskDelay(1);
+   * }, "dispatch", 4096, nullptr, 1, nullptr, 0);
+   * @endcode
+   * @return false if there was nothing to dispatch.
+   * @remark onConnection, onClose and onPing callbacks stay on the I/O thread,
+   * as does everything else (e.g. subscribe()). Stop dispatching before
+   * shutdown().
+   */
+  bool dispatch();
+#endif
 
   /** @return Amount of connected clients. */
-  uint8_t countClients() const;
+  uint16_t countClients() const;
+
+#ifdef _COLLECT_STATS
+  /**
+   * @return Counters of all connections handled by this server (including
+   * those already closed).
+   */
+  WebSocketStats getStats() const;
+#endif
 
   /**
    * @brief
@@ -86,27 +258,180 @@ public:
 
 private:
   /** @cond */
-  WebSocket *_getWebSocket(NetClient &) const;
+#ifdef _SHARDING
+  using MessageQueue = SpscQueue<shared_message_t *, kShardQueueSize>;
+  /// Event loop, written by its own thread (atomics by others as well).
+  struct shard_t {
+    NetServer server;
+    /// Messages from other shards (by index) and one external thread (last).
+    MessageQueue inbox[kMaxShards + 1];
+    /// Duration of the last listen() call (in microseconds).
+    std::atomic<uint32_t> load{0};
+    /// Shard waiting for a connection of this one (-1 if none).
+    std::atomic<int8_t> thief{-1};
+    /// Connection handed over to this shard, and its topics.
+    std::atomic<WebSocket *> stolen{nullptr};
+    uint32_t stolenTopics{0};
+    /// Shard asked for a connection (-1 if none).
+    int8_t victim{-1};
+    /// Free slot kept for the connection asked for (-1 if none).
+    int32_t reserved{-1};
+    /// Taken slots, for countClients() from other threads.
+    std::atomic<uint16_t> clients{0};
+#  ifdef _COLLECT_STATS
+    WebSocketStats closedStats;
+    /// Closed and open connections as of statsTime, for getStats().
+    WebSocketStats stats;
+    mutable std::mutex statsLock;
+    uint32_t statsTime{0};
+#  endif
+  };
+#endif
+
+  /**
+   * @brief Polls server, handshakes new client and reads frames of clients
+   * in slots [first, last).
+   * @return Number of parsed frames.
+   */
+  uint16_t _listen(NetServer &, uint16_t first, uint16_t last);
+  WebSocket *_getWebSocket(
+    NetClient &, uint16_t first, uint16_t last) const;
+  /// @param slot Index in m_sockets.
+  WebSocket *_createWebSocket(
+    uint16_t slot, const NetClient &, const char *protocol);
+  void _releaseWebSocket(WebSocket *&);
+  /// @return Index in m_sockets or -1 if not found.
+  int32_t _findSlot(const WebSocket &) const;
+  /// @return Number of clients with given address (in all shards).
+  uint16_t _countConnections(uint32_t address) const;
+  /**
+   * @brief Sends the same (unmasked) frame to every client in a mask (subject
+   * to overflow policy of each client).
+   */
+  void _sendToAll(const uint32_t mask[], uint8_t channel,
+    const WebSocket::DataType dataType, const char *message, uint16_t length);
+  /// @brief Sends message of a channel (topic or broadcast) to all clients of
+  /// the calling shard and passes it on to other shards.
+  void _publish(uint8_t channel, const WebSocket::DataType dataType,
+    const char *message, uint16_t length);
+#if defined(_SHARDING) || defined(_THREAD_SAFE_SEND)
+  /// @brief Same as above, other shards get a reference (caller keeps its
+  /// own).
+  void _publish(shared_message_t &);
+#endif
+#ifdef _THREAD_SAFE_SEND
+  /** @brief Publishes posted messages. */
+  void _flushPosted();
+  /// @return Endpoint of the calling thread's shard with given id, or nullptr.
+  WebSocket *_findById(uint32_t id) const;
+#endif
+#if defined(_SHARDING) || defined(_THREAD_SAFE_SEND)
+  /// @brief Sends shared message to its recipient or channel (in the calling
+  /// thread's shard).
+  void _deliver(shared_message_t &);
+#endif
+  /// @param[out] first,last Slots of the calling thread's shard (or all).
+  void _ownSlots(uint16_t &first, uint16_t &last) const;
+#ifdef _SHARDING
+  /// @param[out] first,last Range of m_sockets owned by given shard.
+  void _shardSlots(uint8_t shard, uint16_t &first, uint16_t &last) const;
+  /** @brief Sends messages passed on by other shards (and frees them). */
+  void _drainInbox(uint8_t shard);
+  /**
+   * @brief Hands over a backlogged connection to a shard that asked for one,
+   * adopts one handed over to this shard, and asks a busy shard for one when
+   * this one is idle.
+   * @param frames Parsed by the last listen() call.
+   * @param duration Of the last listen() call (in microseconds).
+   */
+  void _balance(uint8_t shard, uint16_t frames, uint32_t duration);
+  static NetClient &_transport(WebSocket &);
+#  ifdef _COLLECT_STATS
+  /// @brief Updates stats snapshot of given shard (every kShardStatsInterval).
+  void _publishStats(uint8_t shard, uint16_t first, uint16_t last);
+#  endif
+#endif
+#ifdef _COLLECT_STATS
+  /// @return Counters of closed connections of the calling thread's shard.
+  WebSocketStats &_closedStats();
+#endif
 
   /// @param[out] protocol
   bool _handleRequest(NetClient &, char selectedProtocol[]);
-  bool _isValidGET(char *line);
+  /// @param[out] path Points into given line.
+  bool _isValidGET(char *line, char *&path);
   bool _isValidUpgrade(const char *line);
   bool _isValidConnection(char *value);
   bool _isValidVersion(uint8_t version);
+  /// @remark Format and expiry are checked before (costly) signature.
+  bool _isValidToken(const char *token) const;
   WebSocketError _validateHandshake(uint8_t flags, const char *secKey);
   void _rejectRequest(NetClient &, const WebSocketError code);
   void _acceptRequest(NetClient &, const char *secKey, const char *protocol);
 
-  void _cleanDeadConnections();
+  void _cleanDeadConnections(uint16_t first, uint16_t last);
+  /// @return true if received messages can't be passed on (dispatch thread
+  /// is behind), data stays in sockets meanwhile.
+  bool _isDispatchBacklogged();
+#ifdef _DISPATCH_THREAD
+  /** @brief Carries out requests queued by message handlers. */
+  void _drainOutbound();
+#endif
   /** @endcond */
 private:
   NetServer m_server;
   WebSocket *m_sockets[kMaxConnections]{};
 
+  static constexpr uint16_t kTopicMaskSize{(kMaxConnections + 31) / 32};
+  /// Bit N of a topic mask represents m_sockets[N].
+  uint32_t m_topics[kMaxTopics][kTopicMaskSize]{};
+#ifdef _STATIC_MEMORY
+  /// Storage for m_sockets (slot N lives in m_pool[N]).
+  alignas(WebSocket) uint8_t m_pool[kMaxConnections][sizeof(WebSocket)];
+  conflation_pool_t m_conflationPool;
+#endif
+
   verifyClientCallback _verifyClient{nullptr};
   protocolHandlerCallback _protocolHandler{nullptr};
   onConnectionCallback _onConnection{nullptr};
+
+  const char *m_tokenKey{nullptr};
+  size_t m_tokenKeyLength{0};
+  const char *m_tokenHeader{nullptr};
+  clockCallback _tokenClock{nullptr};
+
+  uint8_t m_connectionLimit{0};
+  uint16_t m_messageRate{0};
+  uint32_t m_byteRate{0};
+
+#ifdef _SHARDING
+  uint8_t m_shardCount{1};
+  shard_t m_shards[kMaxShards];
+  /// Remote address of each slot (only with per-address limit), other shards
+  /// read it to count connections.
+  std::atomic<uint32_t> m_addresses[kMaxConnections]{};
+#endif
+#ifdef _DISPATCH_THREAD
+  /// Received messages (I/O to dispatch thread).
+  DispatchQueue m_inbound;
+  /// Send requests of message handlers (dispatch to I/O thread).
+  DispatchQueue m_outbound;
+#  ifdef _COLLECT_STATS
+  /// Time spent in message handlers, only the dispatch thread adds to it.
+  std::atomic<uint32_t> m_dispatchTime{0};
+#  endif
+#endif
+#ifdef _THREAD_SAFE_SEND
+  /// Messages of post() (any thread to listen()).
+  PostQueue m_posted;
+  /// Generation of the last endpoint created in each slot (part of its id).
+  uint16_t m_generations[kMaxConnections]{};
+#endif
+
+#ifdef _COLLECT_STATS
+  /// Accumulated counters of closed connections.
+  WebSocketStats m_closedStats;
+#endif
 };
 
 /**
@@ -1,105 +1,220 @@
 #include "Base64.h"
 #include "../platform.h"
+#include <string.h>
 
 #if (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_AVR) ||                            \
   (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_SAMD21) ||                           \
   (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_SAM) ||                              \
   (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_UNO_R4)
 #  include <avr/pgmspace.h>
-#else
+#elif PLATFORM_ARCH != PLATFORM_ARCHITECTURE_POSIX
 #  include <pgmspace.h>
 #endif
 
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX &&                            \
+  (defined(__x86_64__) || defined(__i386__))
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  define HAVE_SSSE3
+#endif
+
+// PROGMEM is a separate address space (AVR) or needs aligned reads (ESP8266)
+// only on some boards, elsewhere tables are indexed directly
+#if (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_AVR) ||                            \
+  (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP8266)
+#  define b64_read(table, i) pgm_read_byte(&(table)[i])
+#else
+#  define b64_read(table, i) ((table)[i])
+#endif
+
 const char PROGMEM b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                     "abcdefghijklmnopqrstuvwxyz"
                                     "0123456789+/";
 
-/* 'Private' declarations */
-inline void a3_to_a4(unsigned char *a4, unsigned char *a3);
-inline void a4_to_a3(unsigned char *a3, unsigned char *a4);
-inline unsigned char b64_lookup(char c);
+namespace {
 
-int base64_encode(char *output, char *input, int inputLen) {
-  int i = 0, j = 0;
-  int encLen = 0;
-  unsigned char a3[3];
-  unsigned char a4[4];
+/* Reverse of b64_alphabet for characters '+' .. 'z', characters outside of
+ * the alphabet decode as 0 */
+const unsigned char PROGMEM b64_reverse[] = {62, 0, 0, 0, 63, 52, 53, 54, 55,
+  56, 57, 58, 59, 60, 61, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+  10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0, 0, 0, 0,
+  0, 0, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42,
+  43, 44, 45, 46, 47, 48, 49, 50, 51};
 
-  while (inputLen--) {
-    a3[i++] = *(input++);
-    if (i == 3) {
-      a3_to_a4(a4, a3);
-
-      for (i = 0; i < 4; i++) {
-        output[encLen++] = pgm_read_byte(&b64_alphabet[a4[i]]);
-      }
+inline unsigned char b64_lookup(char c) {
+  const unsigned char i = static_cast<unsigned char>(c) - '+';
+  return i < sizeof(b64_reverse) ? b64_read(b64_reverse, i) : 0;
+}
 
-      i = 0;
-    }
+#ifdef HAVE_SSSE3
+/* Both SIMD variants load 16 bytes at once, hence they stop while at least
+ * 16 bytes of input are left and let the scalar code finish.
+ * http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+ * http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html */
+
+/* Returns the number of input bytes consumed (12 per 16 characters) */
+__attribute__((target("ssse3"))) int encodeSsse3(
+  char *output, const unsigned char *input, int inputLen) {
+  const __m128i kShuffle =
+    _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i kOffsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+    '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+  int consumed = 0;
+  for (; inputLen - consumed >= 16; consumed += 12, output += 16) {
+    __m128i in = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(input + consumed));
+    in = _mm_shuffle_epi8(in, kShuffle);
+
+    // Spread each 3 bytes into 4 indices (6 bits each)
+    const __m128i ac = _mm_mulhi_epu16(
+      _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+      _mm_set1_epi32(0x04000040));
+    const __m128i bd = _mm_mullo_epi16(
+      _mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+      _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(ac, bd);
+
+    // Map indices to ranges of the alphabet, then add offset of each range
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i out =
+      _mm_add_epi8(indices, _mm_shuffle_epi8(kOffsets, range));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output), out);
   }
+  return consumed;
+}
 
-  if (i) {
-    for (j = i; j < 3; j++) {
-      a3[j] = '\0';
-    }
-
-    a3_to_a4(a4, a3);
-
-    for (j = 0; j < i + 1; j++) {
-      output[encLen++] = pgm_read_byte(&b64_alphabet[a4[j]]);
-    }
+/* Returns the number of characters consumed (16 per 12 bytes), stops at the
+ * first block with a character outside of the alphabet */
+__attribute__((target("ssse3"))) int decodeSsse3(
+  unsigned char *output, const char *input, int inputLen) {
+  // Valid characters by high/low nibble, and offsets to their 6-bit values
+  const __m128i kOffsets =
+    _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i kLowMask = _mm_setr_epi8(
+    static_cast<char>(0xA8), static_cast<char>(0xF8), static_cast<char>(0xF8),
+    static_cast<char>(0xF8), static_cast<char>(0xF8), static_cast<char>(0xF8),
+    static_cast<char>(0xF8), static_cast<char>(0xF8), static_cast<char>(0xF8),
+    static_cast<char>(0xF8), static_cast<char>(0xF0), 0x54, 0x50, 0x50, 0x50,
+    0x54);
+  const __m128i kHighBit = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20,
+    0x40, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i kPack =
+    _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  int consumed = 0;
+  for (; inputLen - consumed >= 16; consumed += 16, output += 12) {
+    const __m128i in = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(input + consumed));
+    const __m128i high =
+      _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+    const __m128i low = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+
+    const __m128i valid = _mm_and_si128(
+      _mm_shuffle_epi8(kLowMask, low), _mm_shuffle_epi8(kHighBit, high));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(valid, _mm_setzero_si128())))
+      break;
 
-    while ((i++ < 3)) {
-      output[encLen++] = '=';
-    }
+    // '+' and '/' share the high nibble
+    const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    const __m128i offsets = _mm_add_epi8(_mm_shuffle_epi8(kOffsets, high),
+      _mm_and_si128(slash, _mm_set1_epi8(-3)));
+    const __m128i values = _mm_add_epi8(in, offsets);
+
+    // Join 4 x 6 bits into 3 bytes (in each 32-bit lane)
+    const __m128i pairs =
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i merged = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    const __m128i out = _mm_shuffle_epi8(merged, kPack);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(output), out);
+    const int last = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+    memcpy(output + 8, &last, 4);
   }
-  output[encLen] = '\0';
-  return encLen;
+  return consumed;
 }
 
-int base64_decode(char *output, char *input, int inputLen) {
-  int i = 0, j = 0;
-  int decLen = 0;
-  unsigned char a3[3];
-  unsigned char a4[4];
+bool hasSsse3() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3);
+}
+#endif
 
-  while (inputLen--) {
-    if (*input == '=') {
-      break;
-    }
+} // namespace
 
-    a4[i++] = *(input++);
-    if (i == 4) {
-      for (i = 0; i < 4; i++) {
-        a4[i] = b64_lookup(a4[i]);
-      }
+int base64_encode(char *output, const char *input, int inputLen) {
+  auto in = reinterpret_cast<const unsigned char *>(input);
+  char *out = output;
 
-      a4_to_a3(a3, a4);
+#ifdef HAVE_SSSE3
+  static const bool simd{hasSsse3()};
+  if (simd) {
+    const int consumed = encodeSsse3(out, in, inputLen);
+    in += consumed;
+    out += consumed / 3 * 4;
+    inputLen -= consumed;
+  }
+#endif
+
+  for (; inputLen >= 3; inputLen -= 3, in += 3, out += 4) {
+    out[0] = b64_read(b64_alphabet, in[0] >> 2);
+    out[1] = b64_read(b64_alphabet, ((in[0] & 0x03) << 4) | (in[1] >> 4));
+    out[2] = b64_read(b64_alphabet, ((in[1] & 0x0F) << 2) | (in[2] >> 6));
+    out[3] = b64_read(b64_alphabet, in[2] & 0x3F);
+  }
 
-      for (i = 0; i < 3; i++) {
-        output[decLen++] = a3[i];
-      }
-      i = 0;
-    }
+  if (inputLen > 0) {
+    const unsigned char second = inputLen > 1 ? in[1] : 0;
+    out[0] = b64_read(b64_alphabet, in[0] >> 2);
+    out[1] = b64_read(b64_alphabet, ((in[0] & 0x03) << 4) | (second >> 4));
+    out[2] = inputLen > 1 ? b64_read(b64_alphabet, (second & 0x0F) << 2) : '=';
+    out[3] = '=';
+    out += 4;
   }
+  *out = '\0';
+  return out - output;
+}
+
+int base64_decode(char *output, const char *input, int inputLen) {
+  // Decoding stops at the first padding character
+  const void *padding = memchr(input, '=', inputLen);
+  if (padding) inputLen = static_cast<const char *>(padding) - input;
 
-  if (i) {
-    for (j = i; j < 4; j++) {
-      a4[j] = '\0';
-    }
+  auto out = reinterpret_cast<unsigned char *>(output);
 
-    for (j = 0; j < 4; j++) {
-      a4[j] = b64_lookup(a4[j]);
-    }
+#ifdef HAVE_SSSE3
+  static const bool simd{hasSsse3()};
+  if (simd) {
+    const int consumed = decodeSsse3(out, input, inputLen);
+    input += consumed;
+    out += consumed / 4 * 3;
+    inputLen -= consumed;
+  }
+#endif
 
-    a4_to_a3(a3, a4);
+  for (; inputLen >= 4; inputLen -= 4, input += 4, out += 3) {
+    const unsigned char a = b64_lookup(input[0]);
+    const unsigned char b = b64_lookup(input[1]);
+    const unsigned char c = b64_lookup(input[2]);
+    const unsigned char d = b64_lookup(input[3]);
+    out[0] = (a << 2) | (b >> 4);
+    out[1] = (b << 4) | (c >> 2);
+    out[2] = (c << 6) | d;
+  }
 
-    for (j = 0; j < i - 1; j++) {
-      output[decLen++] = a3[j];
-    }
+  // 2 or 3 characters left carry 1 or 2 bytes
+  if (inputLen > 1) {
+    const unsigned char a = b64_lookup(input[0]);
+    const unsigned char b = b64_lookup(input[1]);
+    *out++ = (a << 2) | (b >> 4);
+    if (inputLen > 2) *out++ = (b << 4) | (b64_lookup(input[2]) >> 2);
   }
-  output[decLen] = '\0';
-  return decLen;
+  *out = '\0';
+  return out - reinterpret_cast<unsigned char *>(output);
 }
 
 int base64_enc_len(int plainLen) {
@@ -107,7 +222,7 @@ int base64_enc_len(int plainLen) {
   return (n + 2 - ((n + 2) % 3)) / 3 * 4;
 }
 
-int base64_dec_len(char *input, int inputLen) {
+int base64_dec_len(const char *input, int inputLen) {
   int i = 0;
   int numEq = 0;
   for (i = inputLen - 1; input[i] == '='; i--) {
@@ -116,25 +231,3 @@ int base64_dec_len(char *input, int inputLen) {
 
   return ((6 * inputLen) / 8) - numEq;
 }
-
-inline void a3_to_a4(unsigned char *a4, unsigned char *a3) {
-  a4[0] = (a3[0] & 0xfc) >> 2;
-  a4[1] = ((a3[0] & 0x03) << 4) + ((a3[1] & 0xf0) >> 4);
-  a4[2] = ((a3[1] & 0x0f) << 2) + ((a3[2] & 0xc0) >> 6);
-  a4[3] = (a3[2] & 0x3f);
-}
-
-inline void a4_to_a3(unsigned char *a3, unsigned char *a4) {
-  a3[0] = (a4[0] << 2) + ((a4[1] & 0x30) >> 4);
-  a3[1] = ((a4[1] & 0xf) << 4) + ((a4[2] & 0x3c) >> 2);
-  a3[2] = ((a4[2] & 0x3) << 6) + a4[3];
-}
-
-inline unsigned char b64_lookup(char c) {
-  if (c >= 'A' && c <= 'Z') return c - 'A';
-  if (c >= 'a' && c <= 'z') return c - 71;
-  if (c >= '0' && c <= '9') return c + 4;
-  if (c == '+') return 62;
-  if (c == '/') return 63;
-  return -1;
-}
@@ -20,12 +20,15 @@ extern const char b64_alphabet[];
  * 			input: the input buffer for the encoding, stores the binary to be
  * encoded inputLen: the length of the input buffer, in bytes Return value:
  * 			Returns the length of the encoded string
+ * 		Notes:
+ * 			Works on whole 3 byte groups, with SSSE3 (if the CPU has it)
+ * 			on a Linux host
  * 		Requirements:
  * 			1. output must not be null or empty
  * 			2. input must not be null
  * 			3. inputLen must be greater than or equal to 0
  */
-int base64_encode(char *output, char *input, int inputLen);
+int base64_encode(char *output, const char *input, int inputLen);
 
 /* base64_decode:
  * 		Description:
@@ -38,12 +41,15 @@ int base64_encode(char *output, char *input, int inputLen);
  * 			inputLen: the length of the input buffer, in bytes
  * 		Return value:
  * 			Returns the length of the decoded string
+ * 		Notes:
+ * 			Stops at the first '=', other characters outside of the
+ * 			alphabet decode as 0. Uses SSSE3 like base64_encode
  * 		Requirements:
  * 			1. output must not be null or empty
  * 			2. input must not be null
  * 			3. inputLen must be greater than or equal to 0
  */
-int base64_decode(char *output, char *input, int inputLen);
+int base64_decode(char *output, const char *input, int inputLen);
 
 /* base64_enc_len:
  * 		Description:
@@ -73,6 +79,6 @@ int base64_enc_len(int inputLen);
  * 			1. input must not be null
  * 			2. input must be greater than or equal to zero
  */
-int base64_dec_len(char *input, int inputLen);
+int base64_dec_len(const char *input, int inputLen);
 
 #endif // _BASE64_H
\ No newline at end of file
@@ -7,6 +7,21 @@
  * @def _DUMP_HANDSHAKE Prints any handshake request/response on Serial output.
  * @def _DUMP_HEADER Prints frame header on Serial output.
  * @def _DUMP_FRAME_DATA Prints frame data on Serial output.
+ * @def _COLLECT_STATS Enables runtime statistics (WebSocket::getStats()).
+ * @def _STATIC_MEMORY Server (and client) never allocate from heap, connections
+ * are constructed in a pool embedded in WebSocketServer.
+ * @def _TRACE Records frames, state changes and handshake steps in a binary
+ * ring buffer (see dumpTrace()).
+ * @def _CORK Enables WebSocket::cork(), frames are collected and sent in
+ * one write (see kCorkBufferSize).
+ * @def _TLS Enables wss:// in WebSocketClient (ESP32: mbedTLS, Linux: OpenSSL,
+ * link with -lssl -lcrypto).
+ * @def _DISPATCH_THREAD Message handlers of WebSocketServer run on a separate
+ * thread/task (see WebSocketServer::dispatch()), ESP32 and Linux only.
+ * @def _SHARDING WebSocketServer spreads connections across event loops run
+ * by separate threads (see WebSocketServer::setShards()), Linux only.
+ * @def _THREAD_SAFE_SEND Enables WebSocket::post() and WebSocketServer::post(),
+ * which may be called from any thread/task, ESP32 and Linux only.
  */
 
 /**
@@ -15,18 +30,113 @@
  *  - ETHERNET_CONTROLLER_W5X00
  *  - ETHERNET_CONTROLLER_ENC28J60
  *  - NETWORK_CONTROLLER_WIFI
+ *  - NETWORK_CONTROLLER_POSIX (Linux, sockets + epoll)
  */
 
 //#define _DEBUG
 //#define _DUMP_HANDSHAKE
 //#define _DUMP_HEADER
 //#define _DUMP_FRAME_DATA
+//#define _COLLECT_STATS
+//#define _TRACE
+//#define _STATIC_MEMORY
+//#define _CORK
+//#define _TLS
+//#define _DISPATCH_THREAD
+//#define _SHARDING
+//#define _THREAD_SAFE_SEND
 
 #ifndef NETWORK_CONTROLLER
-#  define NETWORK_CONTROLLER ETHERNET_CONTROLLER_W5X00
+#  if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+#    define NETWORK_CONTROLLER NETWORK_CONTROLLER_POSIX
+#  else
+#    define NETWORK_CONTROLLER ETHERNET_CONTROLLER_W5X00
+#  endif
+#endif
+
+/** @def POSIX_MAX_CONNECTIONS Capacity of WebSocketServer on Linux. */
+#ifndef POSIX_MAX_CONNECTIONS
+#  define POSIX_MAX_CONNECTIONS 4096
 #endif
 
 /** Maximum size of data buffer - frame payload (in bytes). */
 constexpr uint16_t kBufferMaxSize{256};
+/**
+ * Outbound data messages longer than this are sent in fragments of this size
+ * and control frames received meanwhile are answered in between (0 disables
+ * fragmentation). onPing may then be called from send(), a close frame waits
+ * for the next listen().
+ */
+constexpr uint16_t kMaxFragmentSize{0};
+/** Number of topics available for WebSocketServer::subscribe(). */
+constexpr uint8_t kMaxTopics{8};
+/**
+ * Default amount of queued outbound data (in bytes) above which an overflow
+ * policy applies (see WebSocket::setOverflowPolicy()).
+ */
+constexpr uint16_t kMaxBacklog{4096};
+/**
+ * Space for messages held back by OverflowPolicy::CONFLATE (per connection,
+ * in bytes), should fit the latest message of every channel.
+ */
+constexpr uint16_t kConflationBufferSize{256};
+/**
+ * With _STATIC_MEMORY, number of conflation buffers embedded in
+ * WebSocketServer, i.e. how many of its connections can use
+ * OverflowPolicy::CONFLATE at once.
+ */
+constexpr uint8_t kConflationPoolSize{1};
+/** Capacity of per-connection output buffer used by cork() (in bytes). */
+constexpr uint16_t kCorkBufferSize{256};
+/** Space for captured state of callbacks (see net::Function). */
+constexpr uint8_t kCallbackStorageSize{2 * sizeof(void *)};
+/**
+ * Maximum length of negotiated subprotocol (including NULL), also of the
+ * list offered by a client. Handshake fails if the selected one is longer.
+ */
+constexpr uint8_t kProtocolMaxSize{32};
 /** Maximum time to wait for endpoint response (in milliseconds). */
 constexpr uint16_t kTimeoutInterval{5000};
+/**
+ * Maximum time to wait for endpoint's close frame after close(code, false)
+ * (in milliseconds), then the connection is terminated.
+ */
+constexpr uint16_t kCloseTimeout{2000};
+/** Initial delay of WebSocketClient auto-reconnect (in milliseconds). */
+constexpr uint32_t kReconnectMinDelay{1000};
+/** Upper bound of WebSocketClient auto-reconnect delay (in milliseconds). */
+constexpr uint32_t kReconnectMaxDelay{60000};
+/** Number of TLS sessions kept for resumption (see TlsClient). */
+constexpr uint8_t kTlsSessionCacheSize{4};
+/** Plaintext collected into a single TLS record (in bytes). */
+constexpr uint16_t kTlsOutputBufferSize{512};
+/**
+ * Capacity of each queue between I/O and dispatch thread, in messages (must
+ * be a power of two, see _DISPATCH_THREAD).
+ */
+constexpr uint16_t kDispatchQueueSize{16};
+/** Maximum number of WebSocketServer shards (see _SHARDING). */
+constexpr uint8_t kMaxShards{8};
+/**
+ * Capacity of each queue passing broadcast/published messages to a shard, in
+ * messages (must be a power of two).
+ */
+constexpr uint16_t kShardQueueSize{64};
+/**
+ * Duration of a shard's listen() call (in microseconds) from which an idle
+ * shard takes over one of its backlogged connections.
+ */
+constexpr uint32_t kStealThreshold{1000};
+/**
+ * Interval (in milliseconds) at which each shard publishes stats of its
+ * connections for WebSocketServer::getStats() (see _COLLECT_STATS).
+ */
+constexpr uint16_t kShardStatsInterval{100};
+/**
+ * Capacity of the queue of messages posted to each endpoint (and to
+ * WebSocketServer), in messages (must be a power of two, see
+ * _THREAD_SAFE_SEND).
+ */
+constexpr uint16_t kPostQueueSize{16};
+/** Number of records held by trace ring buffer (must be a power of two). */
+constexpr uint16_t kTraceBufferSize{64};
@@ -0,0 +1,243 @@
+#include "digest.h"
+#include "CryptoLegacy/SHA1.h"
+
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP32
+#  include <mbedtls/sha1.h>
+#  include <mbedtls/version.h>
+#elif PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+#  if defined(__x86_64__) || defined(__i386__)
+#    include <cpuid.h>
+#    include <immintrin.h>
+#    define HAVE_SHA_NI
+#  elif defined(__aarch64__)
+#    include <arm_neon.h>
+#    include <asm/hwcap.h>
+#    include <sys/auxv.h>
+#    define HAVE_ARM_SHA1
+#  endif
+#endif
+
+namespace net {
+
+#if defined(HAVE_SHA_NI) || defined(HAVE_ARM_SHA1)
+namespace {
+
+/// Compresses whole 64-byte blocks into state.
+using BlockFunction = void (*)(uint32_t state[], const uint8_t *, size_t);
+
+#  ifdef HAVE_SHA_NI
+__attribute__((target("sha,sse4.1"))) void compressShaNi(
+  uint32_t state[], const uint8_t *data, size_t count) {
+  const __m128i kByteSwap{
+    _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL)};
+
+  __m128i abcd{_mm_shuffle_epi32(
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1B)};
+  __m128i e0{_mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0)};
+  __m128i e1;
+  __m128i msg[4];
+
+  for (; count > 0; --count, data += 64) {
+    const __m128i abcdSaved{abcd};
+    const __m128i e0Saved{e0};
+
+    for (uint8_t i = 0; i < 4; ++i) {
+      msg[i] = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * 16)),
+        kByteSwap);
+    }
+
+    // Rounds 0-15 (message words come straight from the block)
+    e0 = _mm_add_epi32(e0, msg[0]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+    e1 = _mm_sha1nexte_epu32(e1, msg[1]);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg[0] = _mm_sha1msg1_epu32(msg[0], msg[1]);
+
+    e0 = _mm_sha1nexte_epu32(e0, msg[2]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    msg[1] = _mm_sha1msg1_epu32(msg[1], msg[2]);
+    msg[0] = _mm_xor_si128(msg[0], msg[2]);
+
+    // Rounds 12-67 share the same shape
+#    define SHA1_GROUP(g, eIn, eOut)                                           \
+      eIn = _mm_sha1nexte_epu32(eIn, msg[g % 4]);                              \
+      eOut = abcd;                                                             \
+      msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], msg[g % 4]);     \
+      abcd = _mm_sha1rnds4_epu32(abcd, eIn, g / 5);                            \
+      msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], msg[g % 4]);     \
+      msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], msg[g % 4])
+
+    SHA1_GROUP(3, e1, e0);
+    SHA1_GROUP(4, e0, e1);
+    SHA1_GROUP(5, e1, e0);
+    SHA1_GROUP(6, e0, e1);
+    SHA1_GROUP(7, e1, e0);
+    SHA1_GROUP(8, e0, e1);
+    SHA1_GROUP(9, e1, e0);
+    SHA1_GROUP(10, e0, e1);
+    SHA1_GROUP(11, e1, e0);
+    SHA1_GROUP(12, e0, e1);
+    SHA1_GROUP(13, e1, e0);
+    SHA1_GROUP(14, e0, e1);
+    SHA1_GROUP(15, e1, e0);
+    SHA1_GROUP(16, e0, e1);
+#    undef SHA1_GROUP
+
+    // Rounds 68-79 (no more message words to schedule)
+    e1 = _mm_sha1nexte_epu32(e1, msg[1]);
+    e0 = abcd;
+    msg[2] = _mm_sha1msg2_epu32(msg[2], msg[1]);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    msg[3] = _mm_xor_si128(msg[3], msg[1]);
+
+    e0 = _mm_sha1nexte_epu32(e0, msg[2]);
+    e1 = abcd;
+    msg[3] = _mm_sha1msg2_epu32(msg[3], msg[2]);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+    e1 = _mm_sha1nexte_epu32(e1, msg[3]);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+    e0 = _mm_sha1nexte_epu32(e0, e0Saved);
+    abcd = _mm_add_epi32(abcd, abcdSaved);
+  }
+
+  _mm_storeu_si128(
+    reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+bool hasShaNi() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  const bool sse41{(ecx & bit_SSE4_1) != 0};
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+  return sse41 && (ebx & (1u << 29)); // SHA extensions
+}
+#  endif
+
+#  ifdef HAVE_ARM_SHA1
+#    ifdef __clang__
+#      define SHA1_ARM_TARGET __attribute__((target("crypto")))
+#    else
+#      define SHA1_ARM_TARGET __attribute__((target("+crypto")))
+#    endif
+
+SHA1_ARM_TARGET void compressArm(
+  uint32_t state[], const uint8_t *data, size_t count) {
+  const uint32x4_t kRoundConstants[4]{vdupq_n_u32(0x5A827999),
+    vdupq_n_u32(0x6ED9EBA1), vdupq_n_u32(0x8F1BBCDC), vdupq_n_u32(0xCA62C1D6)};
+
+  uint32x4_t abcd{vld1q_u32(state)};
+  uint32_t e[2]{state[4], 0};
+
+  for (; count > 0; --count, data += 64) {
+    const uint32x4_t abcdSaved{abcd};
+    const uint32_t eSaved{e[0]};
+
+    uint32x4_t msg[4];
+    for (uint8_t i = 0; i < 4; ++i)
+      msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+    uint32x4_t wk[2]{vaddq_u32(msg[0], kRoundConstants[0]),
+      vaddq_u32(msg[1], kRoundConstants[0])};
+
+    // Group g covers rounds 4g..4g+3, the schedule runs two groups ahead
+    for (uint8_t g = 0; g < 20; ++g) {
+      const uint32_t eIn{e[g % 2]};
+      e[(g + 1) % 2] = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+      if (g < 5)
+        abcd = vsha1cq_u32(abcd, eIn, wk[g % 2]);
+      else if (g < 10 || g >= 15)
+        abcd = vsha1pq_u32(abcd, eIn, wk[g % 2]);
+      else
+        abcd = vsha1mq_u32(abcd, eIn, wk[g % 2]);
+
+      if (g < 18)
+        wk[g % 2] = vaddq_u32(msg[(g + 2) % 4], kRoundConstants[(g + 2) / 5]);
+      if (g >= 1 && g <= 16)
+        msg[(g + 3) % 4] = vsha1su1q_u32(msg[(g + 3) % 4], msg[(g + 2) % 4]);
+      if (g <= 15)
+        msg[g % 4] =
+          vsha1su0q_u32(msg[g % 4], msg[(g + 1) % 4], msg[(g + 2) % 4]);
+    }
+
+    e[0] += eSaved;
+    abcd = vaddq_u32(abcd, abcdSaved);
+  }
+
+  vst1q_u32(state, abcd);
+  state[4] = e[0];
+}
+#    undef SHA1_ARM_TARGET
+
+bool hasArmSha1() { return getauxval(AT_HWCAP) & HWCAP_SHA1; }
+#  endif
+
+BlockFunction detectBlockFunction() {
+#  ifdef HAVE_SHA_NI
+  if (hasShaNi()) return compressShaNi;
+#  endif
+#  ifdef HAVE_ARM_SHA1
+  if (hasArmSha1()) return compressArm;
+#  endif
+  return nullptr;
+}
+
+void digestBlocks(
+  BlockFunction compress, const void *data, size_t length, uint8_t hash[]) {
+  uint32_t state[5]{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  const uint64_t bitLength{static_cast<uint64_t>(length) << 3};
+
+  auto input = static_cast<const uint8_t *>(data);
+  const size_t count{length / 64};
+  if (count > 0) compress(state, input, count);
+  input += count * 64;
+  length -= count * 64;
+
+  // Padding and length need a second block if there is no room left
+  uint8_t tail[128]{};
+  memcpy(tail, input, length);
+  tail[length] = 0x80;
+  const uint8_t tailSize = length < 56 ? 64 : 128;
+  for (uint8_t i = 0; i < 8; ++i)
+    tail[tailSize - 1 - i] = static_cast<uint8_t>(bitLength >> (i * 8));
+  compress(state, tail, tailSize / 64);
+
+  for (uint8_t i = 0; i < 20; ++i)
+    hash[i] = static_cast<uint8_t>(state[i / 4] >> (24 - (i % 4) * 8));
+}
+
+} // namespace
+#endif
+
+void sha1(const void *data, size_t length, uint8_t hash[]) {
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP32
+  // mbedTLS of ESP-IDF drives the SHA peripheral
+  const auto input = static_cast<const unsigned char *>(data);
+#  if MBEDTLS_VERSION_MAJOR >= 3
+  if (mbedtls_sha1(input, length, hash) == 0) return;
+#  else
+  if (mbedtls_sha1_ret(input, length, hash) == 0) return;
+#  endif
+#elif defined(HAVE_SHA_NI) || defined(HAVE_ARM_SHA1)
+  static const BlockFunction compress{detectBlockFunction()};
+  if (compress) return digestBlocks(compress, data, length, hash);
+#endif
+  SHA1::digest(data, length, hash);
+}
+void hmacSha1(const void *key, size_t keyLength, const void *data,
+  size_t length, uint8_t hash[]) {
+  SHA1 hmac;
+  hmac.resetHMAC(key, keyLength);
+  hmac.update(data, length);
+  hmac.finalizeHMAC(key, keyLength, hash, 20);
+}
+
+} // namespace net
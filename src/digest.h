@@ -0,0 +1,24 @@
+#pragma once
+
+/** @file */
+
+#include "utility.h"
+
+namespace net {
+
+/**
+ * @brief Computes SHA-1 of given data on hardware where available: the SHA
+ * peripheral on ESP32, SHA-NI (x86) or ARMv8 crypto extensions on Linux
+ * (detected at runtime). Falls back to portable SHA1::digest().
+ * @param[out] hash Array of 20 elements.
+ */
+void sha1(const void *data, size_t length, uint8_t hash[]);
+/**
+ * @brief Computes HMAC-SHA1 of given data (with SHA1::resetHMAC() and
+ * SHA1::finalizeHMAC()).
+ * @param[out] hash Array of 20 elements.
+ */
+void hmacSha1(const void *key, size_t keyLength, const void *data,
+  size_t length, uint8_t hash[]);
+
+} // namespace net
@@ -0,0 +1,60 @@
+#pragma once
+
+/** @file */
+
+#include "utility.h"
+
+namespace net {
+
+/** @cond */
+template <typename> class Function;
+/** @endcond */
+
+/**
+ * @class Function
+ * @brief Callback holder, accepts function pointers and lambdas with
+ * captures, stored in place (never allocates).
+ * @remark Captured state must be trivially copyable (pointers, references,
+ * numbers ...) and fit into kCallbackStorageSize bytes.
+ * @code{.cpp}
+ * Device device;
+ * ws.onMessage([&device](WebSocket &ws, const WebSocket::DataType,
+ *                const char *message, uint16_t length) {
+ *   device.handle(message, length);
+ * });
+ * @endcode
+ */
+template <typename R, typename... Args> class Function<R(Args...)> {
+public:
+  Function() = default;
+  Function(decltype(nullptr)) {}
+  Function(R (*fn)(Args...)) : Function() {
+    if (fn) _store(fn);
+  }
+  template <typename T> Function(const T &f) { _store(f); }
+
+  explicit operator bool() const { return m_invoke != nullptr; }
+
+  R operator()(Args... args) const { return m_invoke(m_storage, args...); }
+
+private:
+  template <typename T> void _store(const T &f) {
+    static_assert(sizeof(T) <= kCallbackStorageSize,
+      "Captured state doesn't fit into kCallbackStorageSize");
+    static_assert(alignof(T) <= alignof(void *), "Unsupported alignment");
+    static_assert(
+      __is_trivially_copyable(T), "Captured state must be trivially copyable");
+
+    new (m_storage) T(f);
+    m_invoke = &_invoke<T>;
+  }
+  template <typename T> static R _invoke(const void *storage, Args... args) {
+    return (*static_cast<T *>(const_cast<void *>(storage)))(args...);
+  }
+
+private:
+  alignas(void *) uint8_t m_storage[kCallbackStorageSize]{};
+  R (*m_invoke)(const void *, Args...){nullptr};
+};
+
+} // namespace net
@@ -0,0 +1,97 @@
+#pragma once
+
+/** @file */
+
+#include "platform.h"
+#include <atomic>
+
+namespace net {
+
+/**
+ * @class MpscQueue
+ * @brief Lock-free ring of N elements filled by any number of producer
+ * threads (or tasks) and emptied by one consumer.
+ * @code{.cpp}
+ * // Any producer
+ * if (!queue.push(item)) {
+ *   // Full
+ * }
+ * // Consumer
+ * while (auto item = queue.front()) {
+ *   handle(*item);
+ *   queue.pop();
+ * }
+ * @endcode
+ * @remark Every element has a sequence number (bounded queue of D. Vyukov):
+ * a producer claims a position with CAS and publishes it by advancing the
+ * sequence, so a preempted producer holds back only the elements behind its
+ * own. Indices aren't padded, the queue is embedded in every WebSocket.
+ */
+template <typename T, uint16_t N> class MpscQueue {
+  static_assert(N > 1 && N <= 0x8000 && (N & (N - 1)) == 0,
+    "Capacity of MpscQueue must be a power of two");
+
+public:
+  MpscQueue() {
+    for (uint16_t i = 0; i < N; ++i)
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Producer side, safe to call from any thread.
+   * @return false if the queue is full.
+   */
+  bool push(const T &value) {
+    uint16_t tail{m_tail.load(std::memory_order_relaxed)};
+    for (;;) {
+      auto &cell = m_cells[tail & (N - 1)];
+      const auto lag = static_cast<int16_t>(
+        cell.sequence.load(std::memory_order_acquire) - tail);
+      if (lag == 0) {
+        // On failure tail is reloaded
+        if (m_tail.compare_exchange_weak(tail, static_cast<uint16_t>(tail + 1),
+              std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(
+            static_cast<uint16_t>(tail + 1), std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        return false; // Not released by consumer yet
+      } else {
+        tail = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Consumer side.
+   * @return The oldest element, nullptr if the queue is empty (or the oldest
+   * one is still being written).
+   */
+  T *front() {
+    auto &cell = m_cells[m_head & (N - 1)];
+    return cell.sequence.load(std::memory_order_acquire) ==
+               static_cast<uint16_t>(m_head + 1)
+             ? &cell.value
+             : nullptr;
+  }
+  /** @brief Releases element returned by front() (back to producers). */
+  void pop() {
+    m_cells[m_head & (N - 1)].sequence.store(
+      static_cast<uint16_t>(m_head + N), std::memory_order_release);
+    ++m_head;
+  }
+
+private:
+  struct cell_t {
+    std::atomic<uint16_t> sequence;
+    T value;
+  };
+  cell_t m_cells[N];
+  std::atomic<uint16_t> m_tail{0};
+  /// Only the consumer touches it.
+  uint16_t m_head{0};
+};
+
+} // namespace net
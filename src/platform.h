@@ -18,6 +18,7 @@
 #define PLATFORM_ARCHITECTURE_SAMD21 5
 #define PLATFORM_ARCHITECTURE_STM32 6
 #define PLATFORM_ARCHITECTURE_UNO_R4 7
+#define PLATFORM_ARCHITECTURE_POSIX 8
 /** @endcond */
 
 #if defined(__AVR__)
@@ -34,6 +35,8 @@
 #  define PLATFORM_ARCH PLATFORM_ARCHITECTURE_STM32
 #elif defined(ARDUINO_ARCH_RENESAS)
 #  define PLATFORM_ARCH PLATFORM_ARCHITECTURE_UNO_R4
+#elif defined(__linux__)
+#  define PLATFORM_ARCH PLATFORM_ARCHITECTURE_POSIX
 #else
 #  error "Unsupported platform"
 #endif
@@ -46,6 +49,7 @@
 #define ETHERNET_CONTROLLER_W5X00 1
 #define ETHERNET_CONTROLLER_ENC28J60 2
 #define NETWORK_CONTROLLER_WIFI 3
+#define NETWORK_CONTROLLER_POSIX 4
 /** @endcond */
 
 #include "config.h"
@@ -67,6 +71,13 @@ constexpr uint8_t kMaxConnections{4};
 #  include <WiFiClient.h>
 #  include <WiFiServer.h>
 constexpr uint8_t kMaxConnections{8};
+#elif NETWORK_CONTROLLER == NETWORK_CONTROLLER_POSIX
+#  if PLATFORM_ARCH != PLATFORM_ARCHITECTURE_POSIX
+#    error "NETWORK_CONTROLLER_POSIX requires Linux"
+#  endif
+#  include "posix/PosixServer.h"
+/** Limited only by file descriptors (see `ulimit -n`). */
+constexpr uint16_t kMaxConnections{POSIX_MAX_CONNECTIONS};
 #else
 #  error "Network controller is required!"
 #endif
@@ -75,12 +86,63 @@ constexpr uint8_t kMaxConnections{8};
 #if NETWORK_CONTROLLER == NETWORK_CONTROLLER_WIFI
 using NetClient = WiFiClient;
 using NetServer = WiFiServer;
+#elif NETWORK_CONTROLLER == NETWORK_CONTROLLER_POSIX
+using NetClient = net::PosixClient;
+using NetServer = net::PosixServer;
 #else
 using NetClient = EthernetClient;
 using NetServer = EthernetServer;
 #endif
 /** @endcond */
 
+#ifdef _TLS
+#  if PLATFORM_ARCH != PLATFORM_ARCHITECTURE_ESP32 &&                          \
+    PLATFORM_ARCH != PLATFORM_ARCHITECTURE_POSIX
+#    error "_TLS requires ESP32 (mbedTLS) or Linux (OpenSSL)"
+#  endif
+#  include "tls/TlsClient.h"
+/** @cond */
+using NetTransport = net::TlsClient;
+/** @endcond */
+#else
+/** @cond */
+using NetTransport = NetClient;
+/** @endcond */
+#endif
+
+#ifdef _DISPATCH_THREAD
+#  if PLATFORM_ARCH != PLATFORM_ARCHITECTURE_ESP32 &&                          \
+    PLATFORM_ARCH != PLATFORM_ARCHITECTURE_POSIX
+#    error "_DISPATCH_THREAD requires ESP32 (FreeRTOS) or Linux (std::thread)"
+#  endif
+#endif
+#ifdef _SHARDING
+#  if PLATFORM_ARCH != PLATFORM_ARCHITECTURE_POSIX
+#    error "_SHARDING requires Linux"
+#  endif
+#  if defined(_DISPATCH_THREAD) || defined(_STATIC_MEMORY)
+#    error "_SHARDING can't be combined with _DISPATCH_THREAD or _STATIC_MEMORY"
+#  endif
+#  ifdef _TRACE
+#    error "_SHARDING can't be combined with _TRACE (single trace buffer)"
+#  endif
+#endif
+#ifdef _THREAD_SAFE_SEND
+#  if PLATFORM_ARCH != PLATFORM_ARCHITECTURE_ESP32 &&                          \
+    PLATFORM_ARCH != PLATFORM_ARCHITECTURE_POSIX
+#    error "_THREAD_SAFE_SEND requires ESP32 (FreeRTOS) or Linux (std::thread)"
+#  endif
+#  ifdef _STATIC_MEMORY
+#    error "_THREAD_SAFE_SEND can't be combined with _STATIC_MEMORY"
+#  endif
+#endif
+#if defined(_DISPATCH_THREAD) || defined(_SHARDING)
+#  include "spsc.h"
+#endif
+#ifdef _THREAD_SAFE_SEND
+#  include "mpsc.h"
+#endif
+
 /**
  * @def PLATFORM_ARCH
  * @def NETWORK_CONTROLLER
@@ -0,0 +1,234 @@
+#include "../platform.h"
+
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+#  include <arpa/inet.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+
+namespace net {
+
+//
+// PosixClient::Socket:
+//
+
+PosixClient::Socket::Socket(int fd) : fd{fd} {}
+PosixClient::Socket::~Socket() {
+  if (fd != -1) close(fd);
+}
+
+size_t PosixClient::Socket::receive() {
+  if (inputOffset == inputSize) {
+    inputOffset = inputSize = 0;
+  } else if (inputSize == sizeof(input)) {
+    memmove(input, input + inputOffset, inputSize - inputOffset);
+    inputSize -= inputOffset;
+    inputOffset = 0;
+  }
+
+  if (!closed && inputSize < sizeof(input)) {
+    const auto n = recv(fd, input + inputSize, sizeof(input) - inputSize, 0);
+    if (n > 0) {
+      inputSize += n;
+    } else if (n == 0) {
+      closed = true;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Edge-triggered epoll will set it again
+      if (polled) readable = false;
+    } else if (errno != EINTR) {
+      closed = true;
+    }
+  }
+
+  return inputSize - inputOffset;
+}
+void PosixClient::Socket::send() {
+  size_t offset{0};
+  while (offset < output.size()) {
+    const auto n = ::send(
+      fd, output.data() + offset, output.size() - offset, MSG_NOSIGNAL);
+    if (n > 0) {
+      offset += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        closed = true;
+        output.clear();
+        return;
+      }
+      break;
+    }
+  }
+  output.erase(output.begin(), output.begin() + offset);
+}
+
+//
+// PosixClient (public):
+//
+
+int PosixClient::connect(IPAddress ip, uint16_t port) {
+  char host[16]{};
+  snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return connect(host, port);
+}
+int PosixClient::connect(const char *host, uint16_t port) {
+  if (!connectAsync(host, port)) return 0;
+
+  pollfd pfd{m_socket->fd, POLLOUT, 0};
+  poll(&pfd, 1, kTimeoutInterval);
+  if (checkConnect() == 1) return 1;
+  stop();
+  return 0;
+}
+int PosixClient::connectAsync(const char *host, uint16_t port) {
+  stop();
+
+  char service[6]{};
+  snprintf(service, sizeof(service), "%u", port);
+
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result{nullptr};
+  if (getaddrinfo(host, service, &hints, &result) != 0) return 0;
+
+  int fd{-1};
+  bool connecting{false};
+  for (auto it = result; it != nullptr && fd == -1; it = it->ai_next) {
+    fd = socket(it->ai_family, it->ai_socktype | SOCK_NONBLOCK, 0);
+    if (fd == -1) continue;
+
+    if (::connect(fd, it->ai_addr, it->ai_addrlen) == -1) {
+      if (errno == EINPROGRESS) {
+        connecting = true;
+      } else {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  freeaddrinfo(result);
+  if (fd == -1) return 0;
+
+  int enable{1};
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  m_socket = std::make_shared<Socket>(fd);
+  m_socket->connecting = connecting;
+  return 1;
+}
+int8_t PosixClient::checkConnect() {
+  if (!m_socket || m_socket->closed) return -1;
+  if (!m_socket->connecting) return 1;
+
+  pollfd pfd{m_socket->fd, POLLOUT, 0};
+  if (poll(&pfd, 1, 0) != 1) return 0;
+  int error{0};
+  socklen_t length{sizeof(error)};
+  if (getsockopt(m_socket->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 ||
+      error != 0) {
+    m_socket->closed = true;
+    m_socket->output.clear();
+    return -1;
+  }
+  m_socket->connecting = false;
+  return 1;
+}
+
+size_t PosixClient::write(uint8_t c) { return write(&c, 1); }
+size_t PosixClient::write(const uint8_t *buffer, size_t size) {
+  if (!m_socket || m_socket->closed) return 0;
+
+  auto &output = m_socket->output;
+  output.insert(output.end(), buffer, buffer + size);
+  if (!m_socket->connecting || checkConnect() == 1) m_socket->send();
+  return m_socket->closed ? 0 : size;
+}
+int PosixClient::availableForWrite() {
+  // Output queue is unbounded
+  return m_socket && !m_socket->closed ? 0x7FFF : 0;
+}
+
+int PosixClient::available() {
+  if (!m_socket || (m_socket->connecting && checkConnect() != 1)) return 0;
+
+  if (!m_socket->output.empty()) m_socket->send();
+  const auto buffered = m_socket->inputSize - m_socket->inputOffset;
+  if (buffered > 0 || !m_socket->readable) return buffered;
+  return m_socket->receive();
+}
+int PosixClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+int PosixClient::read(uint8_t *buffer, size_t size) {
+  if (!available()) return -1;
+
+  auto &socket = *m_socket;
+  const auto n = std::min(size, socket.inputSize - socket.inputOffset);
+  memcpy(buffer, socket.input + socket.inputOffset, n);
+  socket.inputOffset += n;
+  return n;
+}
+int PosixClient::peek() {
+  return available() ? m_socket->input[m_socket->inputOffset] : -1;
+}
+void PosixClient::flush() {
+  if (!m_socket || (m_socket->connecting && checkConnect() != 1)) return;
+  if (!m_socket->output.empty()) m_socket->send();
+}
+
+void PosixClient::stop() {
+  if (!m_socket) return;
+
+  if (m_socket->fd != -1) {
+    flush();
+    close(m_socket->fd);
+    m_socket->fd = -1;
+  }
+  m_socket->closed = true;
+  m_socket->inputOffset = m_socket->inputSize = 0;
+  m_socket.reset();
+}
+uint8_t PosixClient::connected() {
+  if (!m_socket || m_socket->fd == -1) return 0;
+  // Like EthernetClient: still "connected" while there is unread data
+  return !m_socket->closed || available() > 0;
+}
+PosixClient::operator bool() { return m_socket && m_socket->fd != -1; }
+
+bool PosixClient::operator==(const PosixClient &other) const {
+  return m_socket == other.m_socket;
+}
+bool PosixClient::operator!=(const PosixClient &other) const {
+  return !(*this == other);
+}
+
+IPAddress PosixClient::remoteIP() {
+  sockaddr_in address{};
+  socklen_t length{sizeof(address)};
+  if (!m_socket || getpeername(m_socket->fd,
+                     reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    return IPAddress();
+
+  return IPAddress(static_cast<uint32_t>(address.sin_addr.s_addr));
+}
+
+size_t PosixClient::pendingOutput() const {
+  return m_socket ? m_socket->output.size() : 0;
+}
+
+//
+// PosixClient (private):
+//
+
+PosixClient::PosixClient(const std::shared_ptr<Socket> &socket)
+  : m_socket{socket} {}
+
+} // namespace net
+#endif
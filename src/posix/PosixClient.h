@@ -0,0 +1,97 @@
+#pragma once
+
+/** @file */
+
+#include "compat.h"
+#include <memory>
+#include <vector>
+
+namespace net {
+
+class PosixServer;
+
+/**
+ * @class PosixClient
+ * @brief Non-blocking TCP socket with EthernetClient-like interface.
+ * @remark Like EthernetClient it's a handle, copies refer to the same socket.
+ */
+class PosixClient final : public Client {
+  friend class PosixServer;
+
+public:
+  PosixClient() = default;
+
+  /** @brief Blocking connect (up to kTimeoutInterval). */
+  int connect(IPAddress, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  /**
+   * @brief Starts connecting, doesn't wait for the connection to be
+   * established (only the name resolution may block).
+   * @return 0 if connecting couldn't be started.
+   * @remark Data written in the meantime is queued.
+   */
+  int connectAsync(const char *host, uint16_t port);
+  /**
+   * @return 1 once connected, 0 while connecting, -1 if the connection
+   * couldn't be established.
+   */
+  int8_t checkConnect();
+
+  using Print::write;
+  size_t write(uint8_t) override;
+  /**
+   * @brief Sends data, anything that doesn't fit into the kernel buffer is
+   * queued and sent on subsequent calls (never blocks).
+   */
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int availableForWrite() override;
+
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  /** @brief Tries to send queued data (doesn't block). */
+  void flush() override;
+
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+
+  bool operator==(const PosixClient &) const;
+  bool operator!=(const PosixClient &) const;
+
+  IPAddress remoteIP();
+
+  /** @return Amount of data waiting in the output queue (in bytes). */
+  size_t pendingOutput() const;
+
+private:
+  /** @cond */
+  struct Socket {
+    explicit Socket(int fd);
+    ~Socket();
+
+    int fd;
+    /// Registered in PosixServer's epoll (which maintains "readable" flag).
+    bool polled{false};
+    bool readable{true};
+    bool closed{false};
+    /// Non-blocking connect in progress (until checkConnect() succeeds).
+    bool connecting{false};
+    uint32_t acceptTime{0};
+
+    uint8_t input[4096];
+    size_t inputOffset{0}, inputSize{0};
+    std::vector<uint8_t> output;
+
+    size_t receive();
+    void send();
+  };
+
+  explicit PosixClient(const std::shared_ptr<Socket> &);
+  /** @endcond */
+private:
+  std::shared_ptr<Socket> m_socket;
+};
+
+} // namespace net
@@ -0,0 +1,165 @@
+#include "../utility.h"
+
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+#  include <errno.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/epoll.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+
+namespace net {
+
+namespace {
+
+/// @return true if buffer contains the end of HTTP request head.
+bool isRequestComplete(const uint8_t *data, size_t size) {
+  return size >= 4 && memmem(data, size, "\r\n\r\n", 4) != nullptr;
+}
+
+} // namespace
+
+PosixServer::PosixServer(uint16_t port) : m_port{port} {}
+PosixServer::~PosixServer() { end(); }
+
+void PosixServer::begin() {
+  end();
+
+  m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (m_fd == -1) return;
+
+  int enable{1};
+  setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(m_port);
+  if (bind(m_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ==
+        -1 ||
+      listen(m_fd, SOMAXCONN) == -1) {
+    __debugOutput(F("Unable to listen on port %u\n"), m_port);
+    end();
+    return;
+  }
+
+  _createEpoll();
+}
+void PosixServer::begin(const PosixServer &listener) {
+  end();
+  if (listener.m_fd == -1) return;
+
+  m_port = listener.m_port;
+  m_fd = listener.m_fd;
+  m_shared = true;
+  _createEpoll();
+}
+void PosixServer::end() {
+  m_ready.clear();
+  m_pending.clear();
+  if (m_epoll != -1) close(m_epoll);
+  if (m_fd != -1 && !m_shared) close(m_fd);
+  m_epoll = m_fd = -1;
+  m_shared = false;
+}
+
+PosixClient PosixServer::available() {
+  if (m_epoll == -1) return {};
+
+  constexpr int kMaxEvents{256};
+  epoll_event events[kMaxEvents];
+  int count{0};
+  while ((count = epoll_wait(m_epoll, events, kMaxEvents, 0)) > 0) {
+    for (int i = 0; i < count; ++i) {
+      auto socket = static_cast<PosixClient::Socket *>(events[i].data.ptr);
+      if (!socket) {
+        _accept();
+        continue;
+      }
+
+      // Claimed sockets only need flags, reading is up to the owner
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        socket->readable = true;
+      if ((events[i].events & EPOLLOUT) && !socket->output.empty())
+        socket->send();
+
+      const auto it = m_pending.find(socket);
+      if (it == m_pending.end()) continue;
+
+      socket->receive();
+      if (socket->closed || socket->inputSize == sizeof(socket->input) ||
+          isRequestComplete(socket->input, socket->inputSize)) {
+        m_ready.push_back(it->second);
+        m_pending.erase(it);
+      }
+    }
+    if (count < kMaxEvents) break;
+  }
+  _expireIdleClients();
+
+  if (m_ready.empty()) return {};
+  PosixClient client{m_ready.front()};
+  m_ready.pop_front();
+  return client;
+}
+
+void PosixServer::release(PosixClient &client) {
+  if (m_epoll != -1 && client.m_socket)
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, client.m_socket->fd, nullptr);
+}
+void PosixServer::adopt(PosixClient &client) {
+  if (m_epoll == -1 || !client.m_socket) return;
+
+  auto &socket = *client.m_socket;
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = &socket;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, socket.fd, &event);
+  // An edge might have been reported to the previous server only
+  socket.readable = true;
+}
+
+//
+// Private:
+//
+
+void PosixServer::_createEpoll() {
+  m_epoll = epoll_create1(0);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr; // listening socket
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_fd, &event);
+}
+void PosixServer::_accept() {
+  int fd{-1};
+  while ((fd = accept4(m_fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1) {
+    int enable{1};
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    auto socket = std::make_shared<PosixClient::Socket>(fd);
+    socket->polled = true;
+    socket->acceptTime = millis();
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = socket.get();
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1) continue;
+
+    m_pending.emplace(socket.get(), std::move(socket));
+    // Listening socket is level-triggered, a shared one is left to other
+    // servers after a single accept
+    if (m_shared) break;
+  }
+}
+void PosixServer::_expireIdleClients() {
+  const auto now = millis();
+  for (auto it = m_pending.begin(); it != m_pending.end();) {
+    if (now - it->second->acceptTime > kTimeoutInterval)
+      it = m_pending.erase(it);
+    else
+      ++it;
+  }
+}
+
+} // namespace net
+#endif
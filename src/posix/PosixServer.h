@@ -0,0 +1,72 @@
+#pragma once
+
+/** @file */
+
+#include "PosixClient.h"
+#include <deque>
+#include <unordered_map>
+
+namespace net {
+
+/**
+ * @class PosixServer
+ * @brief Listening socket driven by edge-triggered epoll, with
+ * EthernetServer-like interface.
+ */
+class PosixServer final {
+public:
+  /** @brief Shares listening socket, see begin(const PosixServer &). */
+  PosixServer() = default;
+  explicit PosixServer(uint16_t port);
+  PosixServer(const PosixServer &) = delete;
+  ~PosixServer();
+
+  PosixServer &operator=(const PosixServer &) = delete;
+
+  void begin();
+  /**
+   * @brief Starts polling listening socket of given (begun) server, with own
+   * epoll instance (so each thread can poll its own server). Every server
+   * that polls the socket may accept a new client, one per poll, hence idle
+   * ones take most of them.
+   */
+  void begin(const PosixServer &listener);
+  /** @brief Closes listening socket and drops not yet claimed clients. */
+  void end();
+
+  /**
+   * @brief Polls sockets (doesn't block).
+   * @return Newly accepted client, once it has sent a complete HTTP request
+   * head (or filled the input buffer), otherwise an empty client.
+   * @remark Unlike EthernetServer it never returns already claimed clients,
+   * those are meant to be polled with PosixClient::available().
+   */
+  PosixClient available();
+
+  /** @brief Stops polling a claimed client (to hand it over elsewhere). */
+  void release(PosixClient &);
+  /** @brief Starts polling a client released by another server. */
+  void adopt(PosixClient &);
+
+private:
+  /** @cond */
+  using SocketPtr = std::shared_ptr<PosixClient::Socket>;
+
+  void _createEpoll();
+  void _accept();
+  void _expireIdleClients();
+  /** @endcond */
+private:
+  uint16_t m_port{0};
+  int m_fd{-1};
+  int m_epoll{-1};
+  /// Listening socket belongs to another server.
+  bool m_shared{false};
+
+  /// Accepted sockets waiting for a complete request.
+  std::unordered_map<PosixClient::Socket *, SocketPtr> m_pending;
+  /// Sockets with a complete request, to be returned by available().
+  std::deque<SocketPtr> m_ready;
+};
+
+} // namespace net
@@ -0,0 +1,116 @@
+#include "../platform.h"
+
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+#  include <chrono>
+#  include <thread>
+
+namespace {
+
+const auto g_startTime = std::chrono::steady_clock::now();
+
+template <typename Duration> uint32_t elapsed() {
+  return static_cast<uint32_t>(std::chrono::duration_cast<Duration>(
+    std::chrono::steady_clock::now() - g_startTime)
+                                 .count());
+}
+
+} // namespace
+
+uint32_t millis() { return elapsed<std::chrono::milliseconds>(); }
+uint32_t micros() { return elapsed<std::chrono::microseconds>(); }
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds{ms});
+}
+
+long random(long max) { return max > 0 ? ::random() % max : 0; }
+long random(long min, long max) {
+  return min < max ? min + random(max - min) : min;
+}
+void randomSeed(unsigned long seed) {
+  if (seed != 0) srandom(static_cast<unsigned int>(seed));
+}
+int analogRead(uint8_t) {
+  return static_cast<int>((micros() ^ (micros() >> 10)) & 0x3FF);
+}
+
+//
+// IPAddress:
+//
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+  : m_octets{a, b, c, d} {}
+IPAddress::IPAddress(uint32_t address) {
+  memcpy(m_octets, &address, sizeof(m_octets));
+}
+
+IPAddress::operator uint32_t() const {
+  uint32_t address;
+  memcpy(&address, m_octets, sizeof(address));
+  return address;
+}
+bool IPAddress::operator==(const IPAddress &other) const {
+  return memcmp(m_octets, other.m_octets, sizeof(m_octets)) == 0;
+}
+bool IPAddress::operator!=(const IPAddress &other) const {
+  return !(*this == other);
+}
+
+uint8_t IPAddress::operator[](int index) const { return m_octets[index]; }
+
+//
+// Print:
+//
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n{0};
+  while (size--) {
+    if (!write(*buffer++)) break;
+    ++n;
+  }
+  return n;
+}
+size_t Print::write(const char *buffer, size_t size) {
+  return write(reinterpret_cast<const uint8_t *>(buffer), size);
+}
+int Print::availableForWrite() { return 0; }
+void Print::flush() {}
+
+size_t Print::print(const char *str) { return write(str, strlen(str)); }
+size_t Print::print(const __FlashStringHelper *str) {
+  return print(reinterpret_cast<const char *>(str));
+}
+size_t Print::print(long value, int base) {
+  char buffer[24]{};
+  if (base == 16)
+    snprintf(buffer, sizeof(buffer), "%lx", value);
+  else
+    snprintf(buffer, sizeof(buffer), "%ld", value);
+  return print(buffer);
+}
+size_t Print::print(const IPAddress &ip) {
+  char buffer[16]{};
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return print(buffer);
+}
+size_t Print::println() { return write("\r\n", 2); }
+size_t Print::println(const char *str) { return print(str) + println(); }
+size_t Print::println(const __FlashStringHelper *str) {
+  return print(str) + println();
+}
+size_t Print::println(long value, int base) {
+  return print(value, base) + println();
+}
+size_t Print::println(const IPAddress &ip) { return print(ip) + println(); }
+
+//
+// ConsoleSerial:
+//
+
+ConsoleSerial Serial;
+
+size_t ConsoleSerial::write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+size_t ConsoleSerial::write(const uint8_t *buffer, size_t size) {
+  return fwrite(buffer, 1, size, stdout);
+}
+void ConsoleSerial::flush() { fflush(stdout); }
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+
+/** @file */
+
+//
+// Subset of Arduino API used by the library, for POSIX builds.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <new>
+
+/** @cond */
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define F(string_literal)                                                      \
+  (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+
+#define strcasecmp_P strcasecmp
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strstr_P strstr
+#define strcpy_P strcpy
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+/** @endcond */
+
+/** @return Milliseconds since program start. */
+uint32_t millis();
+/** @return Microseconds since program start. */
+uint32_t micros();
+void delay(uint32_t ms);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+/** @return Noise (there are no analog pins), good enough for randomSeed(). */
+int analogRead(uint8_t pin);
+
+/** @brief IPv4 address. */
+class IPAddress {
+public:
+  IPAddress() = default;
+  IPAddress(uint8_t, uint8_t, uint8_t, uint8_t);
+  /** @param address In network byte order. */
+  explicit IPAddress(uint32_t address);
+
+  /** @return Address in network byte order. */
+  operator uint32_t() const;
+  bool operator==(const IPAddress &) const;
+  bool operator!=(const IPAddress &) const;
+
+  uint8_t operator[](int index) const;
+
+private:
+  uint8_t m_octets[4]{};
+};
+
+class Print {
+public:
+  virtual ~Print() = default;
+
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *buffer, size_t size);
+  virtual int availableForWrite();
+  virtual void flush();
+
+  size_t print(const char *);
+  size_t print(const __FlashStringHelper *);
+  size_t print(long, int base = 10);
+  size_t print(const IPAddress &);
+  size_t println();
+  size_t println(const char *);
+  size_t println(const __FlashStringHelper *);
+  size_t println(long, int base = 10);
+  size_t println(const IPAddress &);
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+/** @brief Common interface of network clients. */
+class Client : public Stream {
+public:
+  virtual int connect(IPAddress, uint16_t port) = 0;
+  virtual int connect(const char *host, uint16_t port) = 0;
+  using Print::write;
+  using Stream::read;
+  virtual int read(uint8_t *buffer, size_t size) = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+};
+
+/** @brief Writes to stdout. */
+class ConsoleSerial final : public Stream {
+public:
+  void begin(unsigned long) {}
+  operator bool() const { return true; }
+
+  using Print::write;
+  size_t write(uint8_t) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  void flush() override;
+
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+extern ConsoleSerial Serial;
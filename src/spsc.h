@@ -0,0 +1,89 @@
+#pragma once
+
+/** @file */
+
+#include "platform.h"
+#include <atomic>
+
+namespace net {
+
+/** @cond */
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+/// Producer and consumer indices live on separate lines (no false sharing).
+constexpr size_t kCacheLineSize{64};
+#else
+// Internal SRAM of ESP32 isn't cached, padding would only waste memory
+constexpr size_t kCacheLineSize{alignof(uint32_t)};
+#endif
+/** @endcond */
+
+/**
+ * @class SpscQueue
+ * @brief Lock-free ring of N elements shared by exactly one producer and one
+ * consumer thread (or task). Elements are filled and read in place.
+ * @code{.cpp}
+ * // Producer
+ * if (auto item = queue.back()) {
+ *   *item = ...;
+ *   queue.push();
+ * }
+ * // Consumer
+ * while (auto item = queue.front()) {
+ *   handle(*item);
+ *   queue.pop();
+ * }
+ * @endcode
+ */
+template <typename T, uint16_t N> class SpscQueue {
+  static_assert(N > 1 && N <= 0x8000 && (N & (N - 1)) == 0,
+    "Capacity of SpscQueue must be a power of two");
+
+public:
+  /**
+   * @brief Producer side.
+   * @return Free element to fill, nullptr if the queue is full.
+   */
+  T *back() {
+    const uint16_t tail{m_tail.load(std::memory_order_relaxed)};
+    if (static_cast<uint16_t>(tail - m_headCache) == N) {
+      m_headCache = m_head.load(std::memory_order_acquire);
+      if (static_cast<uint16_t>(tail - m_headCache) == N) return nullptr;
+    }
+    return &m_items[tail & (N - 1)];
+  }
+  /** @brief Publishes element returned by back(). */
+  void push() {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  }
+
+  /**
+   * @brief Consumer side.
+   * @return The oldest element, nullptr if the queue is empty.
+   */
+  T *front() {
+    const uint16_t head{m_head.load(std::memory_order_relaxed)};
+    if (head == m_tailCache) {
+      m_tailCache = m_tail.load(std::memory_order_acquire);
+      if (head == m_tailCache) return nullptr;
+    }
+    return &m_items[head & (N - 1)];
+  }
+  /** @brief Releases element returned by front() (back to producer). */
+  void pop() {
+    m_head.store(m_head.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  }
+
+private:
+  // Indices run freely (wrap around at 2^16), each side caches the other
+  // one's index and reloads it only when the queue looks full/empty
+  alignas(kCacheLineSize) std::atomic<uint16_t> m_head{0};
+  uint16_t m_tailCache{0};
+  alignas(kCacheLineSize) std::atomic<uint16_t> m_tail{0};
+  uint16_t m_headCache{0};
+
+  T m_items[N];
+};
+
+} // namespace net
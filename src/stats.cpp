@@ -0,0 +1,36 @@
+#include "stats.h"
+
+namespace net {
+
+#ifdef _COLLECT_STATS
+void WebSocketStats::recordPayload(uint16_t length) {
+  uint8_t bucket{0};
+  for (length >>= 3; length && bucket < kPayloadHistogramSize - 1; length >>= 1)
+    ++bucket;
+
+  ++payloadSizes[bucket];
+}
+
+WebSocketStats &WebSocketStats::operator+=(const WebSocketStats &rhs) {
+  connections += rhs.connections;
+  bytesIn += rhs.bytesIn;
+  bytesOut += rhs.bytesOut;
+  framesIn += rhs.framesIn;
+  framesOut += rhs.framesOut;
+  controlFramesIn += rhs.controlFramesIn;
+  controlFramesOut += rhs.controlFramesOut;
+  writes += rhs.writes;
+  messagesDelivered += rhs.messagesDelivered;
+  fragmentedMessages += rhs.fragmentedMessages;
+  protocolErrors += rhs.protocolErrors;
+  droppedMessages += rhs.droppedMessages;
+  callbackTime += rhs.callbackTime;
+  handshakeTime += rhs.handshakeTime;
+  for (uint8_t i = 0; i < kPayloadHistogramSize; ++i)
+    payloadSizes[i] += rhs.payloadSizes[i];
+
+  return *this;
+}
+#endif
+
+} // namespace net
@@ -0,0 +1,78 @@
+#pragma once
+
+/** @file */
+
+#include "platform.h"
+
+#ifdef _COLLECT_STATS
+#  define __statsUpdate(statement) statement
+#  define __statsTimeCallback(stats, ...)                                      \
+    {                                                                          \
+      const uint32_t callbackStart{micros()};                                  \
+      __VA_ARGS__;                                                             \
+      (stats).callbackTime += micros() - callbackStart;                        \
+    }
+#else
+#  define __statsUpdate(statement)
+#  define __statsTimeCallback(stats, ...) __VA_ARGS__
+#endif
+
+namespace net {
+
+#ifdef _COLLECT_STATS
+/** Number of buckets in WebSocketStats::payloadSizes. */
+constexpr uint8_t kPayloadHistogramSize{8};
+
+/**
+ * @brief Runtime counters of a connection (or all connections of a server).
+ * @note Available only with _COLLECT_STATS defined.
+ */
+struct WebSocketStats {
+  /** Number of connections accumulated in this object. */
+  uint32_t connections{0};
+
+  uint32_t bytesIn{0};
+  uint32_t bytesOut{0};
+  uint32_t framesIn{0};
+  uint32_t framesOut{0};
+  uint32_t controlFramesIn{0};
+  uint32_t controlFramesOut{0};
+  /**
+   * Writes issued to NetClient (roughly TCP segments), writes / framesOut
+   * gives segments per frame.
+   */
+  uint32_t writes{0};
+
+  /** Data messages passed to onMessage callback. */
+  uint32_t messagesDelivered{0};
+  /** Delivered messages that have been assembled from continuation frames. */
+  uint32_t fragmentedMessages{0};
+  /** Connections closed with PROTOCOL_ERROR or INVALID_FRAME_PAYLOAD_DATA. */
+  uint32_t protocolErrors{0};
+  /** Broadcast/published messages dropped by an overflow policy. */
+  uint32_t droppedMessages{0};
+
+  /**
+   * Time spent inside user callbacks (in microseconds).
+   * @remark Wraps around after ~71 minutes of accumulated callback time.
+   * @remark With _DISPATCH_THREAD message handlers are counted only by
+   * WebSocketServer::getStats() (not per connection).
+   */
+  uint32_t callbackTime{0};
+  /** Time spent on opening handshake (in milliseconds). */
+  uint32_t handshakeTime{0};
+
+  /**
+   * Sizes of delivered messages, bucket N counts payloads shorter than
+   * 2^(N + 3) bytes, the last bucket holds everything above.
+   */
+  uint32_t payloadSizes[kPayloadHistogramSize]{};
+
+  /** @brief Adds payload length to the histogram. */
+  void recordPayload(uint16_t length);
+
+  WebSocketStats &operator+=(const WebSocketStats &);
+};
+#endif
+
+} // namespace net
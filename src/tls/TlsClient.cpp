@@ -0,0 +1,209 @@
+#include "../utility.h"
+
+#ifdef _TLS
+
+namespace net {
+
+namespace {
+
+struct CachedSession {
+  uint32_t id{0};
+  uint32_t lastUsed{0};
+  void *session{nullptr};
+};
+CachedSession g_sessionCache[kTlsSessionCacheSize];
+
+/// @return FNV-1a hash of host and port (0 is reserved for "no session").
+uint32_t makeSessionId(const char *host, uint16_t port) {
+  uint32_t hash{2166136261UL};
+  for (; *host; ++host)
+    hash = (hash ^ static_cast<uint8_t>(*host)) * 16777619UL;
+  hash = (hash ^ port) * 16777619UL;
+  return hash ? hash : 1;
+}
+
+} // namespace
+
+TlsClient::TlsClient(const NetClient &client) : m_tcp{client} {}
+TlsClient::~TlsClient() { stop(); }
+
+void TlsClient::setSecure(bool enabled, const char *caCert) {
+  m_secureEnabled = enabled;
+  m_verifyPeer = true;
+  m_caCert = caCert;
+}
+void TlsClient::setInsecure() {
+  m_secureEnabled = true;
+  m_verifyPeer = false;
+  m_caCert = nullptr;
+}
+bool TlsClient::isSecure() const { return m_session != nullptr; }
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+  char host[16]{};
+  snprintf_P(host, sizeof(host), (PGM_P)F("%u.%u.%u.%u"), ip[0], ip[1], ip[2],
+    ip[3]);
+  return connect(host, port);
+}
+int TlsClient::connect(const char *host, uint16_t port) {
+  if (!connectAsync(host, port)) return 0;
+
+  const auto start = millis();
+  int8_t status{0};
+  while ((status = checkConnect()) == 0) {
+    if (millis() - start > kTimeoutInterval) {
+      __debugOutput(F("Connection to %s timed out\n"), host);
+      stop();
+      return 0;
+    }
+    delay(1);
+  }
+  return status == 1;
+}
+int TlsClient::connectAsync(const char *host, uint16_t port) {
+  stop();
+  if (!net::connectAsync(m_tcp, host, port)) return 0;
+  if (!m_secureEnabled) return 1;
+
+  m_sessionId = makeSessionId(host, port);
+  if (!_beginHandshake(host, m_sessionId)) {
+    __debugOutput(F("TLS session for %s can't be prepared\n"), host);
+    stop();
+    return 0;
+  }
+  return 1;
+}
+int8_t TlsClient::checkConnect() {
+  const auto status = net::checkConnect(m_tcp);
+  if (status != 1 || !m_session) return status;
+
+  const auto handshake = _handshake();
+  if (handshake == -1) {
+    __debugOutput(F("TLS handshake failed\n"));
+    stop();
+  }
+  return handshake;
+}
+
+size_t TlsClient::write(uint8_t c) { return write(&c, 1); }
+size_t TlsClient::write(const uint8_t *buffer, size_t size) {
+  if (!m_session) return m_tcp.write(buffer, size);
+
+  if (m_outputSize + size > sizeof(m_output)) {
+    flush();
+    if (size > sizeof(m_output)) return _send(buffer, size) ? size : 0;
+  }
+  memcpy(m_output + m_outputSize, buffer, size);
+  m_outputSize += size;
+  return size;
+}
+
+int TlsClient::available() {
+  if (!m_session) return m_tcp.available();
+
+  if (m_peek == -1) {
+    uint8_t c;
+    if (_receive(&c, 1) == 1) m_peek = c;
+  }
+  return (m_peek != -1 ? 1 : 0) + _pending();
+}
+int TlsClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+int TlsClient::read(uint8_t *buffer, size_t size) {
+  if (!m_session) return m_tcp.read(buffer, size);
+  if (size == 0 || !available()) return -1;
+
+  int n{0};
+  if (m_peek != -1) {
+    buffer[n++] = m_peek;
+    m_peek = -1;
+  }
+  if (static_cast<size_t>(n) < size && _pending() > 0) {
+    const auto received = _receive(buffer + n, size - n);
+    if (received > 0) n += received;
+  }
+  return n;
+}
+int TlsClient::peek() {
+  if (!m_session) return m_tcp.peek();
+  return available() ? m_peek : -1;
+}
+void TlsClient::flush() {
+  if (!m_session) return m_tcp.flush();
+
+  if (m_outputSize > 0) {
+    _send(m_output, m_outputSize);
+    m_outputSize = 0;
+  }
+}
+
+void TlsClient::stop() {
+  if (m_session) {
+    flush();
+    _close(m_sessionId);
+  }
+  m_peek = -1;
+  m_outputSize = 0;
+  m_tcp.stop();
+}
+uint8_t TlsClient::connected() {
+  if (!m_session) return m_tcp.connected();
+  return m_tcp.connected() || m_peek != -1 || _pending() > 0;
+}
+TlsClient::operator bool() { return static_cast<bool>(m_tcp); }
+
+bool TlsClient::operator==(const NetClient &other) {
+  return m_tcp == other;
+}
+
+NetClient &TlsClient::transport() { return m_tcp; }
+
+//
+// Session cache:
+//
+
+void *TlsClient::_findSession(uint32_t id) {
+  for (auto &entry : g_sessionCache) {
+    if (entry.session && entry.id == id) {
+      entry.lastUsed = millis();
+      return entry.session;
+    }
+  }
+  return nullptr;
+}
+void TlsClient::_storeSession(uint32_t id, void *session) {
+  CachedSession *slot{&g_sessionCache[0]};
+  for (auto &entry : g_sessionCache) {
+    if (entry.session && entry.id == id) {
+      slot = &entry;
+      break;
+    }
+    // Prefer an empty slot, otherwise the least recently used one
+    if (!entry.session ||
+        (slot->session &&
+          static_cast<int32_t>(entry.lastUsed - slot->lastUsed) < 0))
+      slot = &entry;
+  }
+
+  if (slot->session) _freeSession(slot->session);
+  slot->id = id;
+  slot->lastUsed = millis();
+  slot->session = session;
+}
+
+IPAddress fetchRemoteIp(const TlsClient &client) {
+  return fetchRemoteIp(const_cast<TlsClient &>(client).transport());
+}
+bool isBacklogged(const TlsClient &client, size_t size, size_t threshold) {
+  return isBacklogged(
+    const_cast<TlsClient &>(client).transport(), size, threshold);
+}
+int connectAsync(TlsClient &client, const char *host, uint16_t port) {
+  return client.connectAsync(host, port);
+}
+int8_t checkConnect(TlsClient &client) { return client.checkConnect(); }
+
+} // namespace net
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+
+/** @file */
+
+#include "../platform.h"
+
+namespace net {
+
+/**
+ * @class TlsClient
+ * @brief Transport of WebSocket (when _TLS is defined), passes data through
+ * NetClient or, when secure, through a TLS session on top of it (mbedTLS on
+ * ESP32, OpenSSL on Linux).
+ * @remark Sessions (or tickets) of closed connections are kept in a small
+ * cache (kTlsSessionCacheSize) and offered on the next connect to the same
+ * host, so a reconnect skips the full (asymmetric) handshake.
+ */
+class TlsClient final : public Client {
+public:
+  TlsClient() = default;
+  /** @brief Wraps plain connection (accepted by WebSocketServer). */
+  TlsClient(const NetClient &);
+  TlsClient(const TlsClient &) = delete;
+  ~TlsClient();
+
+  TlsClient &operator=(const TlsClient &) = delete;
+
+  /**
+   * @brief Enables TLS for subsequent connect() calls, server certificate and
+   * host name are verified.
+   * @param caCert PEM encoded certificate(s) used to verify server, nullptr
+   * uses the system trust store (OpenSSL) or the certificate bundle of
+   * ESP-IDF (CONFIG_MBEDTLS_CERTIFICATE_BUNDLE).
+   * @remark Given string must remain valid while connecting.
+   */
+  void setSecure(bool enabled, const char *caCert = nullptr);
+  /**
+   * @brief Enables TLS without verification of server certificate.
+   * @warning Anyone on the path can intercept such connection, meant for
+   * self-signed test servers only.
+   */
+  void setInsecure();
+  bool isSecure() const;
+  /** @return true if the current session has been resumed from cache. */
+  bool isSessionResumed() const;
+
+  /** @brief Blocking TCP connect followed by TLS handshake (if enabled). */
+  int connect(IPAddress, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  /**
+   * @brief Starts connecting (see net::connectAsync()), the TLS handshake is
+   * performed by subsequent checkConnect() calls.
+   * @return 0 if the connection can't be established.
+   */
+  int connectAsync(const char *host, uint16_t port);
+  /**
+   * @brief Advances the TLS handshake as far as received data allows.
+   * @return 1 once connected (and secured), 0 while connecting, -1 if the
+   * connection couldn't be established (the client is stopped then).
+   */
+  int8_t checkConnect();
+
+  using Print::write;
+  size_t write(uint8_t) override;
+  /** @remark Encrypted data is buffered until flush() or buffer is full. */
+  size_t write(const uint8_t *buffer, size_t size) override;
+
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  /** @brief Seals buffered data into a TLS record and sends it. */
+  void flush() override;
+
+  /** @brief Sends close_notify and stores session in cache. */
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+
+  bool operator==(const NetClient &);
+
+  NetClient &transport();
+
+private:
+  /** @cond */
+  struct Session;
+
+  /// @brief Prepares TLS session (offers the cached one).
+  bool _beginHandshake(const char *host, uint32_t sessionId);
+  /// @return 1 if the handshake is finished, 0 if it waits for data, -1 on
+  /// failure.
+  int8_t _handshake();
+  int _receive(uint8_t *buffer, size_t size);
+  bool _send(const uint8_t *buffer, size_t size);
+  size_t _pending() const;
+  void _close(uint32_t sessionId);
+
+  /// @return Session cached for given id (or nullptr), ownership stays.
+  static void *_findSession(uint32_t id);
+  /// @brief Takes ownership of a backend session (evicts the oldest one).
+  static void _storeSession(uint32_t id, void *session);
+  static void _freeSession(void *session);
+  /** @endcond */
+private:
+  NetClient m_tcp;
+  bool m_secureEnabled{false};
+  bool m_verifyPeer{true};
+  const char *m_caCert{nullptr};
+
+  Session *m_session{nullptr};
+  uint32_t m_sessionId{0};
+  int16_t m_peek{-1};
+
+  uint8_t m_output[kTlsOutputBufferSize];
+  uint16_t m_outputSize{0};
+};
+
+IPAddress fetchRemoteIp(const TlsClient &);
+bool isBacklogged(const TlsClient &, size_t size, size_t threshold);
+int connectAsync(TlsClient &, const char *host, uint16_t port);
+int8_t checkConnect(TlsClient &);
+
+} // namespace net
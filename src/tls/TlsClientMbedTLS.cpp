@@ -0,0 +1,201 @@
+#include "../utility.h"
+
+#if defined(_TLS) && PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP32
+#  include <mbedtls/ctr_drbg.h>
+#  include <mbedtls/entropy.h>
+#  include <mbedtls/ssl.h>
+#  include <mbedtls/version.h>
+#  include <mbedtls/x509_crt.h>
+#  ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+#    include <esp_crt_bundle.h>
+#  endif
+
+#  if MBEDTLS_VERSION_MAJOR >= 3
+#    define _FIELD(name) MBEDTLS_PRIVATE(name)
+#  else
+#    define _FIELD(name) name
+#  endif
+
+namespace net {
+
+/** @cond */
+struct TlsClient::Session {
+  Session() {
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&config);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_x509_crt_init(&caCert);
+  }
+  ~Session() {
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&config);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    mbedtls_x509_crt_free(&caCert);
+  }
+
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config config;
+  mbedtls_ctr_drbg_context drbg;
+  mbedtls_entropy_context entropy;
+  mbedtls_x509_crt caCert;
+
+  /// Id of the cached session offered to server (kept as the cache entry
+  /// may be evicted while the handshake is in progress).
+  unsigned char offeredId[32];
+  size_t offeredIdLength{0};
+  bool established{false};
+  bool resumed{false};
+};
+/** @endcond */
+
+namespace {
+
+int sendCallback(void *context, const unsigned char *data, size_t size) {
+  const auto n = static_cast<NetClient *>(context)->write(data, size);
+  return n > 0 ? static_cast<int>(n) : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+int receiveCallback(void *context, unsigned char *data, size_t size) {
+  auto client = static_cast<NetClient *>(context);
+  if (client->available() > 0) {
+    const auto n = client->read(data, size);
+    if (n > 0) return n;
+  }
+  return client->connected() ? MBEDTLS_ERR_SSL_WANT_READ : 0; // 0 = EOF
+}
+
+bool isRetryable(int result) {
+  return result == MBEDTLS_ERR_SSL_WANT_READ ||
+         result == MBEDTLS_ERR_SSL_WANT_WRITE
+#  ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+         || result == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+#  endif
+    ;
+}
+
+/// @return true if server accepted offered session (echoed its id).
+bool isSameSession(
+  const unsigned char *id, size_t length, const mbedtls_ssl_session &current) {
+  return length > 0 && length == current._FIELD(id_len) &&
+         memcmp(id, current._FIELD(id), length) == 0;
+}
+
+} // namespace
+
+bool TlsClient::isSessionResumed() const {
+  return m_session && m_session->resumed;
+}
+
+//
+// Private:
+//
+
+bool TlsClient::_beginHandshake(const char *host, uint32_t sessionId) {
+  m_session = new Session{};
+  auto &s = *m_session;
+
+  constexpr char kPersonalization[]{"mWebSockets"};
+  if (mbedtls_ctr_drbg_seed(&s.drbg, mbedtls_entropy_func, &s.entropy,
+        reinterpret_cast<const unsigned char *>(kPersonalization),
+        sizeof(kPersonalization) - 1) != 0 ||
+      mbedtls_ssl_config_defaults(&s.config, MBEDTLS_SSL_IS_CLIENT,
+        MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+    return false;
+
+  mbedtls_ssl_conf_rng(&s.config, mbedtls_ctr_drbg_random, &s.drbg);
+  if (!m_verifyPeer) {
+    mbedtls_ssl_conf_authmode(&s.config, MBEDTLS_SSL_VERIFY_NONE);
+  } else if (m_caCert) {
+    if (mbedtls_x509_crt_parse(&s.caCert,
+          reinterpret_cast<const unsigned char *>(m_caCert),
+          strlen(m_caCert) + 1) != 0)
+      return false;
+
+    mbedtls_ssl_conf_ca_chain(&s.config, &s.caCert, nullptr);
+    mbedtls_ssl_conf_authmode(&s.config, MBEDTLS_SSL_VERIFY_REQUIRED);
+  } else {
+#  ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+    if (esp_crt_bundle_attach(&s.config) != ESP_OK) return false;
+    mbedtls_ssl_conf_authmode(&s.config, MBEDTLS_SSL_VERIFY_REQUIRED);
+#  else
+    __debugOutput(F("No CA certificate (nor certificate bundle) given\n"));
+    return false;
+#  endif
+  }
+#  ifdef MBEDTLS_SSL_SESSION_TICKETS
+  mbedtls_ssl_conf_session_tickets(
+    &s.config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#  endif
+
+  if (mbedtls_ssl_setup(&s.ssl, &s.config) != 0 ||
+      mbedtls_ssl_set_hostname(&s.ssl, host) != 0)
+    return false;
+  mbedtls_ssl_set_bio(&s.ssl, &m_tcp, sendCallback, receiveCallback, nullptr);
+
+  auto cached = static_cast<mbedtls_ssl_session *>(_findSession(sessionId));
+  if (cached && mbedtls_ssl_set_session(&s.ssl, cached) == 0) {
+    s.offeredIdLength = cached->_FIELD(id_len);
+    memcpy(s.offeredId, cached->_FIELD(id), s.offeredIdLength);
+  }
+  return true;
+}
+int8_t TlsClient::_handshake() {
+  auto &s = *m_session;
+  if (s.established) return 1;
+
+  const auto result = mbedtls_ssl_handshake(&s.ssl);
+  if (result != 0) {
+    if (isRetryable(result)) return 0;
+    __debugOutput(F("mbedtls_ssl_handshake: -0x%04x\n"), -result);
+    return -1;
+  }
+
+  s.established = true;
+  s.resumed =
+    isSameSession(s.offeredId, s.offeredIdLength, *s.ssl._FIELD(session));
+  return 1;
+}
+int TlsClient::_receive(uint8_t *buffer, size_t size) {
+  const auto n = mbedtls_ssl_read(&m_session->ssl, buffer, size);
+  if (n > 0) return n;
+  return isRetryable(n) ? 0 : -1;
+}
+bool TlsClient::_send(const uint8_t *buffer, size_t size) {
+  const auto start = millis();
+  while (size > 0) {
+    const auto n = mbedtls_ssl_write(&m_session->ssl, buffer, size);
+    if (n > 0) {
+      buffer += n;
+      size -= n;
+    } else if (!isRetryable(n) || millis() - start > kTimeoutInterval) {
+      return false;
+    }
+  }
+  return true;
+}
+size_t TlsClient::_pending() const {
+  return mbedtls_ssl_get_bytes_avail(&m_session->ssl);
+}
+void TlsClient::_close(uint32_t sessionId) {
+  if (m_session->established) {
+    auto session = new mbedtls_ssl_session;
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_get_session(&m_session->ssl, session) == 0)
+      _storeSession(sessionId, session);
+    else
+      _freeSession(session);
+
+    mbedtls_ssl_close_notify(&m_session->ssl);
+  }
+  SAFE_DELETE(m_session);
+}
+
+void TlsClient::_freeSession(void *session) {
+  auto p = static_cast<mbedtls_ssl_session *>(session);
+  mbedtls_ssl_session_free(p);
+  delete p;
+}
+
+} // namespace net
+#endif
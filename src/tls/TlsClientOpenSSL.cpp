@@ -0,0 +1,170 @@
+#include "../utility.h"
+
+#if defined(_TLS) && PLATFORM_ARCH == PLATFORM_ARCHITECTURE_POSIX
+#  include <openssl/err.h>
+#  include <openssl/pem.h>
+#  include <openssl/ssl.h>
+#  include <openssl/x509v3.h>
+
+namespace net {
+
+/** @cond */
+struct TlsClient::Session {
+  SSL_CTX *context{nullptr};
+  SSL *ssl{nullptr};
+};
+/** @endcond */
+
+namespace {
+
+/// @return BIO method that reads/writes through NetClient (which has its own
+/// buffers, so SSL can't just use its file descriptor).
+BIO_METHOD *getNetClientMethod() {
+  static BIO_METHOD *method{nullptr};
+  if (method) return method;
+
+  method = BIO_meth_new(
+    BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "NetClient");
+  BIO_meth_set_create(method, [](BIO *bio) {
+    BIO_set_init(bio, 1);
+    return 1;
+  });
+  BIO_meth_set_write(method, [](BIO *bio, const char *data, int size) {
+    BIO_clear_retry_flags(bio);
+    auto client = static_cast<NetClient *>(BIO_get_data(bio));
+    const auto n =
+      client->write(reinterpret_cast<const uint8_t *>(data), size);
+    return n > 0 ? static_cast<int>(n) : -1;
+  });
+  BIO_meth_set_read(method, [](BIO *bio, char *data, int size) {
+    BIO_clear_retry_flags(bio);
+    auto client = static_cast<NetClient *>(BIO_get_data(bio));
+    if (client->available() > 0) {
+      const auto n = client->read(reinterpret_cast<uint8_t *>(data), size);
+      if (n > 0) return n;
+    }
+    if (!client->connected()) return 0; // EOF
+
+    BIO_set_retry_read(bio);
+    return -1;
+  });
+  BIO_meth_set_ctrl(method, [](BIO *, int cmd, long, void *) -> long {
+    return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+  });
+  return method;
+}
+
+bool isIpAddress(const char *host) {
+  return strspn(host, "0123456789.") == strlen(host);
+}
+
+bool loadCertificates(SSL_CTX *context, const char *pem) {
+  auto bio = BIO_new_mem_buf(pem, -1);
+  auto store = SSL_CTX_get_cert_store(context);
+  uint8_t count{0};
+  X509 *cert{nullptr};
+  while ((cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr))) {
+    if (X509_STORE_add_cert(store, cert) == 1) ++count;
+    X509_free(cert);
+  }
+  ERR_clear_error(); // PEM_read_bio_X509 fails at the end of data
+  BIO_free(bio);
+  return count > 0;
+}
+
+} // namespace
+
+bool TlsClient::isSessionResumed() const {
+  return m_session && SSL_session_reused(m_session->ssl);
+}
+
+//
+// Private:
+//
+
+bool TlsClient::_beginHandshake(const char *host, uint32_t sessionId) {
+  m_session = new Session{};
+  auto &context = m_session->context;
+  auto &ssl = m_session->ssl;
+
+  context = SSL_CTX_new(TLS_client_method());
+  if (!context) return false;
+  SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+  // Sessions are cached by TlsClient (across SSL_CTX instances)
+  SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+  if (m_verifyPeer) {
+    if (m_caCert ? !loadCertificates(context, m_caCert)
+                 : SSL_CTX_set_default_verify_paths(context) != 1) {
+      __debugOutput(F("Can't load CA certificates\n"));
+      return false;
+    }
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, nullptr);
+  }
+
+  ssl = SSL_new(context);
+  if (!ssl) return false;
+  auto bio = BIO_new(getNetClientMethod());
+  BIO_set_data(bio, &m_tcp);
+  SSL_set_bio(ssl, bio, bio);
+
+  if (isIpAddress(host)) {
+    if (m_verifyPeer)
+      X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host);
+  } else {
+    SSL_set_tlsext_host_name(ssl, host);
+    if (m_verifyPeer) SSL_set1_host(ssl, host);
+  }
+
+  if (auto session = static_cast<SSL_SESSION *>(_findSession(sessionId)))
+    SSL_set_session(ssl, session);
+  return true;
+}
+int8_t TlsClient::_handshake() {
+  auto ssl = m_session->ssl;
+  if (SSL_is_init_finished(ssl)) return 1;
+
+  const auto result = SSL_connect(ssl);
+  if (result == 1) return 1;
+  const auto error = SSL_get_error(ssl, result);
+  if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) return 0;
+
+  __debugOutput(
+    F("SSL_connect: %s\n"), ERR_error_string(ERR_get_error(), nullptr));
+  return -1;
+}
+int TlsClient::_receive(uint8_t *buffer, size_t size) {
+  const auto n = SSL_read(m_session->ssl, buffer, static_cast<int>(size));
+  if (n > 0) return n;
+
+  const auto error = SSL_get_error(m_session->ssl, n);
+  return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ? 0
+                                                                       : -1;
+}
+bool TlsClient::_send(const uint8_t *buffer, size_t size) {
+  return SSL_write(m_session->ssl, buffer, static_cast<int>(size)) ==
+         static_cast<int>(size);
+}
+size_t TlsClient::_pending() const { return SSL_pending(m_session->ssl); }
+void TlsClient::_close(uint32_t sessionId) {
+  auto ssl = m_session->ssl;
+  if (ssl && SSL_is_init_finished(ssl)) {
+    // With TLS 1.3 tickets arrive after the handshake, hence it's done here
+    auto session = SSL_get1_session(ssl);
+    if (session && SSL_SESSION_is_resumable(session))
+      _storeSession(sessionId, session);
+    else if (session)
+      SSL_SESSION_free(session);
+
+    SSL_shutdown(ssl);
+  }
+  if (ssl) SSL_free(ssl); // Frees BIO as well
+  if (m_session->context) SSL_CTX_free(m_session->context);
+  SAFE_DELETE(m_session);
+}
+
+void TlsClient::_freeSession(void *session) {
+  SSL_SESSION_free(static_cast<SSL_SESSION *>(session));
+}
+
+} // namespace net
+#endif
@@ -0,0 +1,55 @@
+#include "trace.h"
+
+namespace net {
+
+#ifdef _TRACE
+static_assert((kTraceBufferSize & (kTraceBufferSize - 1)) == 0,
+  "kTraceBufferSize must be a power of two");
+static_assert(sizeof(TraceRecord) == 12, "Unexpected TraceRecord padding");
+
+namespace {
+
+TraceRecord g_records[kTraceBufferSize]{};
+/// Total number of recorded events (including overwritten ones).
+uint32_t g_counter{0};
+
+} // namespace
+
+void traceEvent(
+  const void *source, TraceEvent event, uint8_t arg, uint32_t value) {
+  auto &record = g_records[g_counter++ & (kTraceBufferSize - 1)];
+  record.timestamp = micros();
+  record.source = static_cast<uint16_t>(reinterpret_cast<uintptr_t>(source));
+  record.event = static_cast<uint8_t>(event);
+  record.arg = arg;
+  record.value = value;
+}
+
+//
+// Dump format:
+//
+// [4] Magic "WSTR"
+// [1] Version
+// [1] Size of a record
+// [2] Number of records
+// [N * 12] Records
+//
+void dumpTrace(Print &output) {
+  constexpr uint8_t kVersion{1};
+
+  const uint16_t count =
+    g_counter < kTraceBufferSize ? g_counter : kTraceBufferSize;
+  const uint8_t header[]{'W', 'S', 'T', 'R', kVersion, sizeof(TraceRecord),
+    static_cast<uint8_t>(count & 0xFF), static_cast<uint8_t>(count >> 8)};
+  output.write(header, sizeof(header));
+
+  for (uint32_t i = g_counter - count; i != g_counter; ++i) {
+    output.write(reinterpret_cast<const uint8_t *>(
+                   &g_records[i & (kTraceBufferSize - 1)]),
+      sizeof(TraceRecord));
+  }
+}
+void clearTrace() { g_counter = 0; }
+#endif
+
+} // namespace net
@@ -0,0 +1,62 @@
+#pragma once
+
+/** @file */
+
+#include "platform.h"
+
+#ifdef _TRACE
+#  define __traceEvent(event, arg, value)                                      \
+    net::traceEvent(this, net::TraceEvent::event, arg, value)
+#else
+#  define __traceEvent(...)
+#endif
+
+namespace net {
+
+/** Event types stored in the trace ring buffer. */
+enum class TraceEvent : uint8_t {
+  /** arg = opcode, value = payload length */
+  FRAME_RX = 1,
+  /** arg = opcode, value = payload length */
+  FRAME_TX,
+  /** arg = new WebSocket::ReadyState */
+  STATE_CHANGE,
+  HANDSHAKE_BEGIN,
+  /** arg = line number of request/response */
+  HANDSHAKE_STEP,
+  /** value = HTTP status code (101 on success) */
+  HANDSHAKE_END,
+  /** arg = opcode of a message that is passed to a callback */
+  CALLBACK_BEGIN,
+  CALLBACK_END
+};
+
+#ifdef _TRACE
+/**
+ * @brief Fixed-size trace record (12 bytes), stored and dumped as is
+ * (little-endian).
+ */
+struct TraceRecord {
+  /** In microseconds. */
+  uint32_t timestamp;
+  /** Low 16 bits of the address of the object that emitted an event. */
+  uint16_t source;
+  uint8_t event;
+  uint8_t arg;
+  uint32_t value;
+};
+
+/** @brief Appends a record to the ring buffer, overwrites the oldest one. */
+void traceEvent(const void *source, TraceEvent, uint8_t arg, uint32_t value);
+
+/**
+ * @brief Writes content of the ring buffer (oldest first) preceded by a
+ * header, use node.js/trace-decoder.js to convert the output to Chrome
+ * trace-event JSON.
+ */
+void dumpTrace(Print &);
+/** @brief Discards all records. */
+void clearTrace();
+#endif
+
+} // namespace net
@@ -36,4 +36,35 @@ IPAddress fetchRemoteIp(const NetClient &client) {
 #endif
 }
 
+bool isBacklogged(const NetClient &client, size_t size, size_t threshold) {
+#if NETWORK_CONTROLLER == NETWORK_CONTROLLER_POSIX
+  return client.pendingOutput() + size > threshold;
+#elif (NETWORK_CONTROLLER == ETHERNET_CONTROLLER_W5X00) ||                     \
+  (PLATFORM_ARCH == PLATFORM_ARCHITECTURE_ESP8266)
+  // write() would wait for free space in the transmit buffer
+  (void)threshold;
+  return static_cast<size_t>(
+           const_cast<NetClient &>(client).availableForWrite()) < size;
+#else
+  (void)client, (void)size, (void)threshold;
+  return false;
+#endif
+}
+
+int connectAsync(NetClient &client, const char *host, uint16_t port) {
+#if NETWORK_CONTROLLER == NETWORK_CONTROLLER_POSIX
+  return client.connectAsync(host, port);
+#else
+  return client.connect(host, port);
+#endif
+}
+int8_t checkConnect(NetClient &client) {
+#if NETWORK_CONTROLLER == NETWORK_CONTROLLER_POSIX
+  return client.checkConnect();
+#else
+  // Connected by connectAsync() already (or not at all)
+  return client.connected() ? 1 : -1;
+#endif
+}
+
 } // namespace net
@@ -2,6 +2,12 @@
 
 #include "platform.h"
 
+#if PLATFORM_ARCH == PLATFORM_ARCHITECTURE_AVR
+#  include <new.h>
+#else
+#  include <new>
+#endif
+
 #define SAFE_DELETE(ptr)                                                       \
   {                                                                            \
     if (ptr != nullptr) {                                                      \
@@ -29,5 +35,24 @@ void printf(const __FlashStringHelper *fmt, ...);
 namespace net {
 
 IPAddress fetchRemoteIp(const NetClient &);
+/**
+ * @return true if given amount of data can't be written without pushing
+ * queued output over threshold (Linux) or without blocking until endpoint
+ * acknowledges previous data (W5X00, ESP8266), always false where the network
+ * library doesn't tell.
+ */
+bool isBacklogged(const NetClient &, size_t size, size_t threshold);
+
+/**
+ * @brief Starts connecting without waiting for the connection (Linux), the
+ * other network libraries only offer blocking NetClient::connect().
+ * @return 0 if the connection can't be established.
+ */
+int connectAsync(NetClient &, const char *host, uint16_t port);
+/**
+ * @return 1 once connected, 0 while connecting, -1 if the connection couldn't
+ * be established.
+ */
+int8_t checkConnect(NetClient &);
 
 } // namespace net